@@ -1,10 +1,14 @@
 QT       += core gui
 
-greaterThan(QT_MAJOR_VERSION, 4): QT += widgets openglwidgets concurrent
+# Headless - no widgets, QOpenGL* classes moved to the opengl module in Qt 6
+QT += concurrent
+greaterThan(QT_MAJOR_VERSION, 5): QT += opengl
 
 QT_CONFIG -= no-pkg-config
 
 CONFIG += c++11
+CONFIG += console
+CONFIG -= app_bundle
 CONFIG += precompile_header
 CONFIG += link_pkgconfig
 
@@ -16,6 +20,13 @@ PKGCONFIG += opencv4 hdf5
 
 INCLUDEPATH += /Users/janos/.lib
 
+# Baseline build, runs on every node. The CPU kernels carry AVX2 and
+# AVX-512 variants and pick one at run time (src/cpukernel.h). No FMA
+# contraction, so the plain loops of every variant round alike.
+gcc|clang {
+  QMAKE_CXXFLAGS += -ffp-contract=off
+}
+
 # You can make your code fail to compile if it uses deprecated APIs.
 # In order to do so, uncomment the following line.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
@@ -24,24 +35,44 @@ PRECOMPILED_HEADER = pch.h
 
 SOURCES += \
     main.cpp \
-    mainwindow.cpp \
     src/args.cpp \
+    src/cpukernel.cpp \
+    src/cpukernelavx2.cpp \
+    src/cpukernelavx512.cpp \
+    src/cpurender.cpp \
+    src/cubemap.cpp \
     src/exporter.cpp \
+    src/fanout.cpp \
+    src/fastmath.cpp \
+    src/geometry.cpp \
     src/helpers.cpp \
+    src/pool.cpp \
+    src/sampler.cpp \
+    src/taskBench.cpp \
+    src/taskCheck.cpp \
     src/taskExport.cpp \
-    src/taskSplit.cpp
+    src/taskSplit.cpp \
+    src/tiles.cpp \
+    src/uploader.cpp
 
 HEADERS += \
-    mainwindow.h \
     pch.h \
     src/args.h \
+    src/cpukernel.h \
+    src/cpukernelrows.h \
+    src/cpurender.h \
+    src/cubemap.h \
     src/exporter.h \
+    src/fanout.h \
+    src/fastmath.h \
+    src/geometry.h \
     src/helpers.h \
     src/indicators.h \
-    src/tasks.h
-
-FORMS += \
-    mainwindow.ui
+    src/pool.h \
+    src/sampler.h \
+    src/tasks.h \
+    src/tiles.h \
+    src/uploader.h
 
 # Default rules for deployment.
 qnx: target.path = /tmp/$${TARGET}/bin
@@ -8,31 +8,78 @@
 #include "pch.h"
 
 
-int main(int argc, char *argv[])
+// Without a display, render on Mesa's surfaceless EGL platform. The eglfs
+// plugin only needs an EGL display, and its offscreen surfaces are
+// surfaceless contexts - we draw into FBOs only.
+static void setupHeadless(bool force)
 {
-    QApplication a(argc, argv);
+#ifdef Q_OS_LINUX
+    // Explicit choice of the user
+    if (qEnvironmentVariableIsSet("QT_QPA_PLATFORM")) return;
 
-    setlocale(LC_NUMERIC, "C");
+    bool hasDisplay = qEnvironmentVariableIsSet("DISPLAY") ||
+                      qEnvironmentVariableIsSet("WAYLAND_DISPLAY");
+    if (hasDisplay && !force) return;
+
+    qputenv("QT_QPA_PLATFORM", "eglfs");
 
+    // No KMS device or framebuffer in containers
+    if (!qEnvironmentVariableIsSet("QT_QPA_EGLFS_INTEGRATION")) {
+        qputenv("QT_QPA_EGLFS_INTEGRATION", "none");
+    }
+    if (!qEnvironmentVariableIsSet("EGL_PLATFORM")) {
+        qputenv("EGL_PLATFORM", "surfaceless");
+    }
+#else
+    Q_UNUSED(force);
+#endif
+}
+
+
+int main(int argc, char *argv[])
+{
     Args        args;
     if (!args.parse(argc, argv)) {
         return -1;
     }
 
-
     if (args.split.size() == 2) {
 
-        // Execute split
+        // Execute split - no GUI needed
+        QCoreApplication a(argc, argv);
+        setlocale(LC_NUMERIC, "C");
+
         return taskSplit(args);
 
-    } else {
+    }
+
+    if (args.bench) {
+
+        // Microbenchmarks of the CPU kernels
+        QCoreApplication a(argc, argv);
+        setlocale(LC_NUMERIC, "C");
+
+        return taskBench(args);
+    }
+
+    if (args.renderer == "cpu") {
+
+        // Execute export on the CPU - no GL at all
+        QCoreApplication a(argc, argv);
+        setlocale(LC_NUMERIC, "C");
 
-        // Execute export
         return taskExport(args);
+    }
+
+    // Execute export - offscreen contexts only, no event loop
+    setupHeadless(args.headless);
+    QGuiApplication a(argc, argv);
+    setlocale(LC_NUMERIC, "C");
 
+    // Tiled against untiled rendering, nothing exported
+    if (args.check) {
+        return taskCheck(args);
     }
 
-    MainWindow w;
-    w.show();
-    return a.exec();
+    return taskExport(args);
 }
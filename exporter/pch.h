@@ -10,10 +10,11 @@
 #define PCH_H
 
 
-#include <QApplication>
-#include <QMainWindow>
+#include <QGuiApplication>
+#include <QImage>
 
 #include <QtCore>
+#include <QtConcurrent>
 
 #include <opencv2/opencv.hpp>
 #include <H5Cpp.h>
@@ -32,11 +33,18 @@
 #include "src/tasks.h"
 
 
-#include "mainwindow.h"
-
-
 
 #include "src/exporter.h"
+#include "src/geometry.h"
+#include "src/sampler.h"
+#include "src/fastmath.h"
+#include "src/cpukernel.h"
+#include "src/cubemap.h"
+#include "src/uploader.h"
+#include "src/tiles.h"
+#include "src/pool.h"
+#include "src/fanout.h"
+#include "src/cpurender.h"
 
 
 
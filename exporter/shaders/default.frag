@@ -1,32 +1,90 @@
+/*
+    Permutations, defined by PinholeProgram per preset:
 
+        DISTORTION_POLY2P       - poly-2p lens model, pinhole otherwise
+        COLOR_PROCESSING        - HSV, gamma, vignetting & noise augmentation
+        FOOTPRINT_SAMPLING      - mip-mapped sampling over the pixel footprint
+        TILED_PANORAMA          - panorama split into a texture array
+        PAIRED_OUTPUT           - undistorted twin into the second attachment
+        CUBEMAP_PANORAMA        - panorama resampled into a cube map
+*/
+#ifdef FOOTPRINT_SAMPLING
+#extension GL_ARB_shader_texture_lod : require
+#endif
+#ifdef TILED_PANORAMA
+#extension GL_EXT_texture_array : require
+#endif
+
+#ifdef CUBEMAP_PANORAMA
+uniform samplerCube texture;
+#else
 uniform sampler2D texture;
-uniform sampler1D textureDistort;
+#endif
 varying highp vec2 t;
+varying highp vec3 vrk0;
+varying highp vec3 vrk1;
+varying highp vec3 vrk2;
+varying highp vec4 vcrop;
+varying highp vec4 vaug0;          // hue shift, saturation, value, gamma
+varying highp vec4 vaug1;          // noise sigma, vignetting, noise seed
 
-uniform mat3 rk;
 uniform highp vec2 canvas;
-uniform vec4 args;
-uniform vec4 k;
+uniform highp vec2 pixelStep;
+uniform highp vec2 noiseGrid;       // stored pixels, scaleSize
+
+#ifdef TILED_PANORAMA
+// Layer per tile in the table, -1 falls back to the overview bound as texture
+uniform sampler2DArray tiles;
+uniform sampler2D tileTable;
+uniform highp vec4 tileGrid;        // panorama w, h, tile content, layer size
+uniform highp vec2 tileCount;
+#endif
 
 const float PI = 3.1415926535897932384626433832795;
 const float PI_2 = 1.57079632679489661923;
 
 
-float distortRate(float r, float rMax)
+#ifdef DISTORTION_POLY2P
+
+// Inverse of the poly-2p model. Newton on f(r) = r*(1 + k1*r^2 + k2*r^4) - rd,
+// seeded with the first order inverse - same as undistortRadius() on the CPU.
+float undistortRadius(float rd, float k1, float k2)
+{
+    float rd2 = rd*rd;
+    float s = 1.0 + k1*rd2 + k2*rd2*rd2;
+    float r = (s > 0.1 ? rd / s : rd);
+
+    for (int i=0; i<4; i++) {
+        float r2 = r*r;
+        float r4 = r2*r2;
+        float fr = r*(1.0 + k1*r2 + k2*r4) - rd;
+        float df = 1.0 + 3.0*k1*r2 + 5.0*k2*r4;
+        if (df <= 1e-6) break;
+        r -= fr / df;
+    }
+
+    return r;
+}
+
+float distortRate(float r)
 {
-    vec4 s = texture1D(textureDistort, r / rMax);
-    return s.r;
+    if (r <= 0.0) return 1.0;
+    return undistortRadius(r, vcrop.x, vcrop.y) / r;
 }
 
 
-vec2 distort(vec2 p, vec2 c, float rMax)
+vec2 distort(vec2 p, vec2 c)
 {
     p = p - c;
     float r = length(p);
-    float d = distortRate(r, rMax);
+    float d = distortRate(r);
     return c + (p * d);
 }
 
+#endif
+
+#ifdef COLOR_PROCESSING
+
 vec3 gamma(vec3 c, float gamma)
 {
     return pow(c, vec3(1. / gamma));
@@ -50,10 +108,32 @@ vec3 hsv2rgb(vec3 c)
     return c.z * mix(K.xxx, clamp(p - K.xxx, 0.0, 1.0), c.y);
 }
 
+float hash(vec2 p)
+{
+    return fract(sin(dot(p, vec2(12.9898, 78.233))) * 43758.5453);
+}
+
+// Gaussian noise per stored pixel, Box-Muller over two hashes
+float gaussNoise(vec2 pixel, float seed)
+{
+    float u1 = max(hash(pixel + seed * 1013.0), 1.0e-6);
+    float u2 = hash(pixel.yx + seed * 2027.0 + 17.0);
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * PI * u2);
+}
+
+#endif
+
+
+vec3 ray(vec2 p)
+{
+    mat3    rk = mat3(vrk0, vrk1, vrk2);
+    return rk * vec3(p.x, p.y, 1.0);
+}
 
 vec2 reproject(vec2 p)
 {
     vec2    result;
+    mat3    rk = mat3(vrk0, vrk1, vrk2);
     vec3    dp = normalize(vec3(p.x, p.y, 1.0));
     vec3    r = rk * dp;
 
@@ -69,37 +149,149 @@ vec2 reproject(vec2 p)
 
 vec4 process(vec4 color)
 {
+#ifdef COLOR_PROCESSING
     vec3 c = color.rgb;
 
     // HSV
     vec3 _hsv = rgb2hsv(c);
-    _hsv.x += args.x;
-    _hsv.yz *= args.yz;
+    _hsv.x += vaug0.x;
+    _hsv.yz *= vaug0.yz;
     _hsv.x = mod(_hsv.x, 1.0);
     _hsv.yz = clamp(_hsv.yz, 0.0, 1.0);
     c = hsv2rgb(_hsv);
 
     // gamma correction
-    c = gamma(c, args[3]);
+    c = gamma(c, vaug0.w);
+
+    // vignetting, radial falloff towards the corners
+    vec2 d = (t - vec2(0.5, 0.5)) * canvas;
+    float r2 = dot(d, d) / dot(0.5 * canvas, 0.5 * canvas);
+    c *= 1.0 - vaug1.y * r2;
 
-    return vec4(c.rgb, 1.0);
+    // sensor noise - one sample per scaleSize pixel, so the downsample
+    // averages equal values and sigma means the same in every mode
+    if (vaug1.x > 0.0) {
+        vec2 pixel = floor(t * noiseGrid);
+        c += vaug1.x * gaussNoise(pixel, vaug1.z);
+    }
+
+    return vec4(clamp(c, 0.0, 1.0), 1.0);
+#else
+    return vec4(color.rgb, 1.0);
+#endif
 }
 
 
-void main()
+vec2 panoramaCoord(vec2 tc)
 {
-    float w = 0.5*canvas.x;
-    float rMax = sqrt(0.5*0.5 + w*w);
-
     // Rescale for aspect ratio
-    vec2 i = t * canvas;
+    vec2 i = tc * canvas;
     vec2 c = vec2(0.5, 0.5) * canvas;
 
     // compute distortion & reprojection
-    vec2 distortedPos = distort(i, c, rMax);
-    vec2 rep = reproject(distortedPos);
-    vec4 color = texture2D(texture, rep);
+#ifdef DISTORTION_POLY2P
+    i = distort(i, c);
+#endif
+    return reproject(i);
+}
+
+// Same view through the ideal pinhole
+vec2 pinholeCoord(vec2 tc)
+{
+    return reproject(tc * canvas);
+}
+
+
+#ifdef CUBEMAP_PANORAMA
+
+// Cube maps take the ray itself - a major axis select and a divide
+vec3 panoramaRay(vec2 tc)
+{
+    vec2 i = tc * canvas;
+    vec2 c = vec2(0.5, 0.5) * canvas;
+#ifdef DISTORTION_POLY2P
+    i = distort(i, c);
+#endif
+    return ray(i);
+}
+
+vec3 pinholeRay(vec2 tc)
+{
+    return ray(tc * canvas);
+}
+
+#else
+
+
+vec4 samplePanorama(vec2 rep)
+{
+#ifdef TILED_PANORAMA
+    vec2 p = rep * tileGrid.xy;
+    p.x = mod(p.x, tileGrid.x);
+    p.y = clamp(p.y, 0.0, tileGrid.y);
+
+    vec2 tile = min(floor(p / tileGrid.z), tileCount - 1.0);
+    float layer = texture2D(tileTable, (tile + 0.5) / tileCount).r;
+    if (layer >= 0.0) {
+        float gutter = 0.5 * (tileGrid.w - tileGrid.z);
+        vec2 local = (p - tile * tileGrid.z + gutter) / tileGrid.w;
+        return texture2DArray(tiles, vec3(local, layer));
+    }
+#endif
+    return texture2D(texture, rep);
+}
+
+
+// Footprint of one output pixel on the panorama, from the Jacobian
+// of the mapping over one pixel step - repX, repY are the neighbours
+vec4 sampleFootprint(vec2 rep, vec2 repX, vec2 repY)
+{
+#if defined(FOOTPRINT_SAMPLING) && !defined(TILED_PANORAMA)
+    vec2 ddx = repX - rep;
+    vec2 ddy = repY - rep;
+
+    // longitude wraps around
+    ddx.x -= floor(ddx.x + 0.5);
+    ddy.x -= floor(ddy.x + 0.5);
+
+    return texture2DGradARB(texture, rep, ddx, ddy);
+#else
+    // Tiles carry no mip chain
+    return samplePanorama(rep);
+#endif
+}
+
+#endif
+
+
+void main()
+{
+    vec2 dx = vec2(pixelStep.x, 0.0);
+    vec2 dy = vec2(0.0, pixelStep.y);
+
+#if defined(CUBEMAP_PANORAMA)
+    // No seam to unwrap, the mip level follows the implicit derivatives
+    vec4 color = textureCube(texture, panoramaRay(t));
+#elif defined(FOOTPRINT_SAMPLING)
+    vec4 color = sampleFootprint(panoramaCoord(t), panoramaCoord(t + dx), panoramaCoord(t + dy));
+#else
+    vec4 color = samplePanorama(panoramaCoord(t));
+#endif
+
+#ifdef PAIRED_OUTPUT
+#if defined(CUBEMAP_PANORAMA)
+    vec4 plain = textureCube(texture, pinholeRay(t));
+#elif defined(FOOTPRINT_SAMPLING)
+    vec4 plain = sampleFootprint(pinholeCoord(t), pinholeCoord(t + dx), pinholeCoord(t + dy));
+#else
+    vec4 plain = samplePanorama(pinholeCoord(t));
+#endif
 
+    // Same augmentation on both, noise included
+    gl_FragData[0] = process(color);
+    gl_FragData[1] = process(plain);
+#else
     // Result color
     gl_FragColor = process(color);
+#endif
 }
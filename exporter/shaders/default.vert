@@ -1,12 +1,31 @@
 
-
 attribute highp vec4 vertex;
 attribute highp vec2 tex;
 
+// Per-crop data, constant over the crop's quad
+attribute highp vec3 rk0;
+attribute highp vec3 rk1;
+attribute highp vec3 rk2;
+attribute highp vec4 crop;      // k1, k2, -, -
+attribute highp vec4 augment0;  // hue shift, saturation, value, gamma
+attribute highp vec4 augment1;  // noise sigma, vignetting, noise seed, -
+
 varying highp vec2 t;
+varying highp vec3 vrk0;
+varying highp vec3 vrk1;
+varying highp vec3 vrk2;
+varying highp vec4 vcrop;
+varying highp vec4 vaug0;
+varying highp vec4 vaug1;
 
 void main()
 {
     t = tex;
+    vrk0 = rk0;
+    vrk1 = rk1;
+    vrk2 = rk2;
+    vcrop = crop;
+    vaug0 = augment0;
+    vaug1 = augment1;
     gl_Position = vertex;
 }
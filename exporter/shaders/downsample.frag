@@ -0,0 +1,41 @@
+
+uniform sampler2D source;
+uniform highp vec2 sourceSize;
+uniform highp vec2 targetSize;
+
+// Max source texels per output pixel along one axis
+#define MAX_TAPS 16
+
+
+// Overlap of the output pixel footprint [a0,a1] with texel [i,i+1]
+float coverage(float a0, float a1, float i)
+{
+    return max(0.0, min(a1, i + 1.0) - max(a0, i));
+}
+
+
+void main()
+{
+    // Area filter, same weights as cv::INTER_AREA
+    vec2 scale = sourceSize / targetSize;
+    vec2 a0 = floor(gl_FragCoord.xy) * scale;
+    vec2 a1 = a0 + scale;
+    vec2 i0 = floor(a0);
+
+    vec4 sum = vec4(0.0);
+    for (int y=0; y<MAX_TAPS; y++) {
+        float sy = i0.y + float(y);
+        if (sy >= a1.y) break;
+        float wy = coverage(a0.y, a1.y, sy);
+
+        for (int x=0; x<MAX_TAPS; x++) {
+            float sx = i0.x + float(x);
+            if (sx >= a1.x) break;
+            float wx = coverage(a0.x, a1.x, sx);
+
+            sum += (wx * wy) * texture2D(source, (vec2(sx, sy) + 0.5) / sourceSize);
+        }
+    }
+
+    gl_FragColor = sum / (scale.x * scale.y);
+}
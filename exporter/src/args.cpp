@@ -24,10 +24,20 @@
     -os <SPLIT_JSON>            = output split json file
     -ot <TRAINING_H5>           = output H5 file for training images
     -ov <VALIDATION_H5>         = output H5 file for validation images
+    -pool <N>                   = number of render contexts, overrides preset
+    -headless                   = EGL surfaceless rendering, even with a display
+    -renderer <gl|cpu>          = render backend, gl by default
+    -bench                      = CPU kernel microbenchmarks, nothing exported
+    -check                      = tiled against untiled paired GL rendering
 
 */
 
-Args::Args()
+Args::Args() :
+    pool(0),
+    headless(false),
+    renderer("gl"),
+    bench(false),
+    check(false)
 {
 
 }
@@ -110,6 +120,30 @@ bool Args::parse(int argc, char *argv[])
             }
             this->outputValidationH5 = std::string(argv[i]);
         } else
+        if (strcmp(argv[i], "-pool") == 0) {
+            i ++;
+            if (i >= argc || sscanf(argv[i], "%d", &this->pool) != 1 || this->pool < 1) {
+                printf("Expected number of render contexts!!\n");
+                return false;
+            }
+        } else
+        if (strcmp(argv[i], "-headless") == 0) {
+            this->headless = true;
+        } else
+        if (strcmp(argv[i], "-renderer") == 0) {
+            i ++;
+            if (i >= argc || (strcmp(argv[i], "gl") != 0 && strcmp(argv[i], "cpu") != 0)) {
+                printf("Expected renderer gl or cpu!!\n");
+                return false;
+            }
+            this->renderer = std::string(argv[i]);
+        } else
+        if (strcmp(argv[i], "-bench") == 0) {
+            this->bench = true;
+        } else
+        if (strcmp(argv[i], "-check") == 0) {
+            this->check = true;
+        } else
         {
             // Unexpected argument !!
             printf("Unexpected argument: %s\n", argv[i]);
@@ -24,6 +24,11 @@
     -os <SPLIT_JSON>            = output split json file
     -ot <TRAINING_H5>           = output H5 file for training images
     -ov <VALIDATION_H5>         = output H5 file for validation images
+    -pool <N>                   = number of render contexts, overrides preset
+    -headless                   = EGL surfaceless rendering, even with a display
+    -renderer <gl|cpu>          = render backend, gl by default
+    -bench                      = CPU kernel microbenchmarks, nothing exported
+    -check                      = tiled against untiled paired GL rendering
 
 */
 
@@ -39,6 +44,11 @@ public:
     std::string         outputSplitJson;
     std::string         outputTrainingH5;
     std::string         outputValidationH5;
+    int                 pool;
+    bool                headless;
+    std::string         renderer;
+    bool                bench;
+    bool                check;
 
 public:
     Args();
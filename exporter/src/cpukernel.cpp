@@ -0,0 +1,236 @@
+//-----------------------------------------------------------------------------
+//
+//  Football360 Exporter
+//
+//  Author : Igor Janos
+//
+//-----------------------------------------------------------------------------
+#include "pch.h"
+
+// Baseline build of the row kernels
+#include "cpukernelrows.h"
+
+
+namespace Exporter {
+
+
+
+//-----------------------------------------------------------------------------
+//
+//  Dispatch
+//
+//-----------------------------------------------------------------------------
+
+const KernelSet *kernelsScalar()
+{
+    static const KernelSet  kernels = variantKernels("scalar");
+    return &kernels;
+}
+
+std::vector<const KernelSet*> kernelSets()
+{
+    std::vector<const KernelSet*>   sets;
+    sets.push_back(kernelsScalar());
+
+#ifdef KERNEL_X86
+    // Checks the OS saves the wide registers as well
+    __builtin_cpu_init();
+    bool    avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    bool    avx512 = avx2 && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl") &&
+                     __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512dq");
+
+    // The wide getters run target code, the CPU check goes first
+    if (avx2 && kernelsAVX2()) sets.push_back(kernelsAVX2());
+    if (avx512 && kernelsAVX512()) sets.push_back(kernelsAVX512());
+#endif
+
+    return sets;
+}
+
+const KernelSet &activeKernels()
+{
+    static const KernelSet  *active = kernelSets().back();
+    return *active;
+}
+
+const char *kernelISA()
+{
+    return activeKernels().isa;
+}
+
+void reprojectRow(const KernelView &view, const KernelPanorama &pano, int y,
+                  float *r, float *g, float *b)
+{
+    activeKernels().reprojectRow(view, pano, y, r, g, b);
+}
+
+void distortRow(const KernelView &view, int y, float *ix, float *iy)
+{
+    activeKernels().distortRow(view, y, ix, iy);
+}
+
+void colorRow(const KernelColor &color, int y, float *r, float *g, float *b)
+{
+    activeKernels().colorRow(color, y, r, g, b);
+}
+
+void accumulateRow(const AreaTaps &taps, float wy,
+                   const float *r, const float *g, const float *b,
+                   float *accR, float *accG, float *accB)
+{
+    activeKernels().accumulateRow(taps, wy, r, g, b, accR, accG, accB);
+}
+
+void packRow(const float *r, const float *g, const float *b, int w, uint8_t *dst)
+{
+    activeKernels().packRow(r, g, b, w, dst);
+}
+
+
+//-----------------------------------------------------------------------------
+//
+//  Panorama layouts
+//
+//-----------------------------------------------------------------------------
+
+size_t blockedSize(int width, int height)
+{
+    size_t  bx = (width + KernelPanorama::BLOCK - 1) / KernelPanorama::BLOCK;
+    size_t  by = (height + KernelPanorama::BLOCK - 1) / KernelPanorama::BLOCK;
+    return bx * by * KernelPanorama::BLOCK * KernelPanorama::BLOCK;
+}
+
+KernelPanorama blockedPanorama(const uint32_t *storage, int width, int height)
+{
+    int     bx = (width + KernelPanorama::BLOCK - 1) / KernelPanorama::BLOCK;
+
+    KernelPanorama  pano;
+    pano.pixels = storage;
+    pano.width = width;
+    pano.height = height;
+    pano.stride = bx * KernelPanorama::BLOCK * KernelPanorama::BLOCK;
+    pano.layout = KernelPanorama::LAYOUT_BLOCKED;
+    return pano;
+}
+
+void blockRow(const KernelPanorama &linear, uint32_t *storage, int row)
+{
+    KernelPanorama  dst = blockedPanorama(storage, linear.width, linear.height);
+    int     y0 = row * KernelPanorama::BLOCK;
+    int     y1 = std::min(y0 + (int)KernelPanorama::BLOCK, linear.height);
+
+    // Padding of the last blocks is never sampled
+    for (int y=y0; y<y1; y++) {
+        const uint32_t  *src = linear.pixels + (size_t)y * linear.stride;
+        uint32_t        *out = storage + texelRow(dst, y);
+        for (int x=0; x<linear.width; x += KernelPanorama::BLOCK) {
+            int n = std::min((int)KernelPanorama::BLOCK, linear.width - x);
+            memcpy(out + texelCol(dst, x), src + x, n * sizeof(uint32_t));
+        }
+    }
+}
+
+size_t cubeStorageSize(int size)
+{
+    size_t  side = size + 2 * KernelPanorama::CUBE_GUTTER;
+    return KernelPanorama::CUBE_FACES * side * side;
+}
+
+KernelPanorama cubePanorama(const uint32_t *storage, int size)
+{
+    KernelPanorama  pano;
+    pano.pixels = storage;
+    pano.width = size;
+    pano.height = size;
+    pano.stride = size + 2 * KernelPanorama::CUBE_GUTTER;
+    pano.layout = KernelPanorama::LAYOUT_CUBE;
+    return pano;
+}
+
+void cubeFaceRow(const KernelPanorama &equirect, uint32_t *storage, int size, int face, int y)
+{
+    // Direction of face texel (sc, tc) in -1..1, inverse of the major axis select
+    static const float  axes[6][9] = {
+        {  0,  0,  1,    0, -1,  0,   -1,  0,  0 },
+        {  0,  0, -1,    0, -1,  0,    1,  0,  0 },
+        {  1,  0,  0,    0,  0,  1,    0,  1,  0 },
+        {  1,  0,  0,    0,  0, -1,    0, -1,  0 },
+        {  1,  0,  0,    0, -1,  0,    0,  0,  1 },
+        { -1,  0,  0,    0, -1,  0,    0,  0, -1 }
+    };
+
+    // Each face is a 90 degree pinhole view, the gutter widens it a bit.
+    // Texel centers x + 0.5 map to sc = k * (x + 0.5) - c.
+    int     side = size + 2 * KernelPanorama::CUBE_GUTTER;
+    float   k = 2.0f / size;
+    float   c = 1.0f + 2.0f * KernelPanorama::CUBE_GUTTER / size;
+    const float *A = axes[face];
+
+    KernelView  view;
+    for (int i=0; i<3; i++) {
+        view.rk[3*i + 0] = A[3*i + 0] * k;
+        view.rk[3*i + 1] = A[3*i + 1] * k;
+        view.rk[3*i + 2] = A[3*i + 2] - (A[3*i + 0] + A[3*i + 1]) * c;
+    }
+    view.canvasX = (float)side;
+    view.canvasY = (float)side;
+    view.k1 = view.k2 = 0.0f;
+    view.distortion = false;
+    view.width = side;
+    view.height = side;
+    view.grid = nullptr;
+
+    std::vector<float>  rgb(3 * side);
+    float   *r = rgb.data();
+    float   *g = r + side;
+    float   *b = g + side;
+    reprojectRow(view, equirect, y, r, g, b);
+
+    uint32_t    *dst = storage + (size_t)face * side * side + (size_t)y * side;
+    for (int x=0; x<side; x++) {
+        dst[x] = 0xff000000u |
+                 ((uint32_t)(r[x] * 255.0f + 0.5f) << 16) |
+                 ((uint32_t)(g[x] * 255.0f + 0.5f) << 8) |
+                 (uint32_t)(b[x] * 255.0f + 0.5f);
+    }
+}
+
+void AreaTaps::build(int srcSize, int dstSize)
+{
+    first.clear();
+    src.clear();
+    weight.clear();
+
+    // Same as computeResizeAreaTab of OpenCV
+    double  scale = (double)srcSize / dstSize;
+    for (int d=0; d<dstSize; d++) {
+        double  fs1 = d * scale;
+        double  fs2 = fs1 + scale;
+        double  cell = std::min(scale, srcSize - fs1);
+        int     s1 = (int)ceil(fs1);
+        int     s2 = (int)floor(fs2);
+
+        s2 = std::min(s2, srcSize - 1);
+        s1 = std::min(s1, s2);
+
+        first.push_back((int)src.size());
+        if (s1 - fs1 > 1e-3) {
+            src.push_back(s1 - 1);
+            weight.push_back((float)((s1 - fs1) / cell));
+        }
+        for (int s=s1; s<s2; s++) {
+            src.push_back(s);
+            weight.push_back((float)(1.0 / cell));
+        }
+        if (fs2 - s2 > 1e-3) {
+            src.push_back(s2);
+            weight.push_back((float)(std::min(std::min(fs2 - s2, 1.0), cell) / cell));
+        }
+    }
+    first.push_back((int)src.size());
+}
+
+
+
+
+}
@@ -0,0 +1,157 @@
+//-----------------------------------------------------------------------------
+//
+//  Football360 Exporter
+//
+//  Author : Igor Janos
+//
+//-----------------------------------------------------------------------------
+#ifndef CPUKERNEL_H
+#define CPUKERNEL_H
+
+// x86 builds carry SIMD variants of the kernels, picked at run time
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define KERNEL_X86
+#endif
+
+
+namespace Exporter {
+
+//-----------------------------------------------------------------------------
+//
+//  CPU reprojection kernels
+//
+//  Same math as default.frag - pinhole ray through R * K^-1, inverse
+//  poly-2p distortion, equirectangular mapping and bilinear sampling
+//  with the texture wrapped in both directions. One output row at a
+//  time, eight pixels per step with AVX2, a scalar loop otherwise.
+//
+//  The build targets the baseline of the architecture. The row kernels
+//  are compiled again for AVX2 / FMA and for AVX-512 in their own
+//  translation units, the first call picks the widest set the CPU
+//  supports and the free functions below go through it.
+//
+//-----------------------------------------------------------------------------
+
+// Per-crop constants, the varyings of the shader
+class KernelView
+{
+public:
+    float           rk[9];          // R * K^-1, row major
+    float           canvasX, canvasY;
+    float           k1, k2;
+    bool            distortion;
+    int             width, height;  // output pixels
+
+    // Distorted canvas positions of every pixel, planar x / y per row,
+    // from distortRow. Skips the inverse distortion when set.
+    const float     *grid;
+};
+
+// BGRA panorama, as uploaded to the GL texture. Linear rows, or blocks of
+// BLOCK x BLOCK texels so the bilinear taps of rotated crops stay within
+// a few cache lines and pages. A cube map holds six square faces in the
+// order and orientation of GL_TEXTURE_CUBE_MAP_POSITIVE_X .. NEGATIVE_Z,
+// each behind a gutter of its neighbours so the bilinear taps never
+// cross faces.
+class KernelPanorama
+{
+public:
+    enum { LAYOUT_LINEAR = 0, LAYOUT_BLOCKED = 1, LAYOUT_CUBE = 2 };
+    enum { BLOCK_SHIFT = 3, BLOCK = 1 << BLOCK_SHIFT };
+    enum { CUBE_FACES = 6, CUBE_GUTTER = 1 };
+
+    const uint32_t  *pixels;
+    int             width, height;  // face size of a cube
+    int             stride;         // in pixels, of a row or a row of blocks
+    int             layout;
+};
+
+// Blocked copy of a linear panorama, storage of blockedSize pixels.
+// Rows of blocks are independent, blockRow can run in parallel.
+size_t blockedSize(int width, int height);
+KernelPanorama blockedPanorama(const uint32_t *storage, int width, int height);
+void blockRow(const KernelPanorama &linear, uint32_t *storage, int row);
+
+// Planar RGB of output row y, 0..1
+void reprojectRow(const KernelView &view, const KernelPanorama &pano, int y,
+                  float *r, float *g, float *b);
+
+// Cube map of an equirectangular panorama, storage of cubeStorageSize pixels.
+// Row y of face f includes the gutter, 0 .. size + 1.
+size_t cubeStorageSize(int size);
+KernelPanorama cubePanorama(const uint32_t *storage, int size);
+void cubeFaceRow(const KernelPanorama &equirect, uint32_t *storage, int size, int face, int y);
+
+// Canvas position of every pixel of row y after distort(), the
+// rotation and fov do not matter
+void distortRow(const KernelView &view, int y, float *ix, float *iy);
+
+// Area filter along one axis - the weights of cv::resize with INTER_AREA
+// when downscaling. Output i reads src[first[i] .. first[i+1]).
+class AreaTaps
+{
+public:
+    std::vector<int>    first;
+    std::vector<int>    src;
+    std::vector<float>  weight;
+
+    void build(int srcSize, int dstSize);
+};
+
+// acc += wy * horizontal area filter of one source row
+void accumulateRow(const AreaTaps &taps, float wy,
+                   const float *r, const float *g, const float *b,
+                   float *accR, float *accG, float *accB);
+
+// Color stage of default.frag, per-crop constants
+class KernelColor
+{
+public:
+    float           hue, saturation, value, gamma;
+    float           noise, vignetting, seed;
+    float           canvasX, canvasY;
+    int             width, height;  // output pixels
+    int             noiseWidth, noiseHeight;    // noise grid, scaleSize
+};
+
+// Augmentation of row y in place, clamped to 0..1
+void colorRow(const KernelColor &color, int y, float *r, float *g, float *b);
+
+// Planar RGB to packed BGR bytes, as the frames store them
+void packRow(const float *r, const float *g, const float *b, int w, uint8_t *dst);
+
+
+// One build of the row kernels
+class KernelSet
+{
+public:
+    const char      *isa;
+
+    void (*reprojectRow)(const KernelView&, const KernelPanorama&, int, float*, float*, float*);
+    void (*distortRow)(const KernelView&, int, float*, float*);
+    void (*colorRow)(const KernelColor&, int, float*, float*, float*);
+    void (*accumulateRow)(const AreaTaps&, float, const float*, const float*, const float*,
+                          float*, float*, float*);
+    void (*packRow)(const float*, const float*, const float*, int, uint8_t*);
+    void (*fastAtan2)(const float*, const float*, float*, int);
+    void (*fastAsin)(const float*, float*, int);
+    void (*fastRsqrt)(const float*, float*, int);
+};
+
+// Variants, null where the build has none
+const KernelSet *kernelsScalar();
+const KernelSet *kernelsAVX2();
+const KernelSet *kernelsAVX512();
+
+// Sets this CPU can run, baseline first
+std::vector<const KernelSet*> kernelSets();
+
+// The widest of them, picked once
+const KernelSet &activeKernels();
+const char *kernelISA();
+
+
+}
+
+#endif // CPUKERNEL_H
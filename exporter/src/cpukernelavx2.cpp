@@ -0,0 +1,58 @@
+//-----------------------------------------------------------------------------
+//
+//  Football360 Exporter
+//
+//  Author : Igor Janos
+//
+//-----------------------------------------------------------------------------
+#include "pch.h"
+
+
+//-----------------------------------------------------------------------------
+//
+//  Row kernels for AVX2 / FMA, eight lanes. Only the functions from here
+//  on get the target, pch.h and its templates stay on the baseline.
+//
+//-----------------------------------------------------------------------------
+
+#ifdef KERNEL_X86
+
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx2,fma"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#endif
+
+#define KERNEL_AVX2
+#include "cpukernelrows.h"
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+namespace Exporter {
+
+// Only after the CPU check - variantKernels() above is built for the target
+const KernelSet *kernelsAVX2()
+{
+    static const KernelSet  kernels = variantKernels("avx2");
+    return &kernels;
+}
+
+}
+
+#else
+
+namespace Exporter {
+
+const KernelSet *kernelsAVX2()
+{
+    return nullptr;
+}
+
+}
+
+#endif
@@ -0,0 +1,60 @@
+//-----------------------------------------------------------------------------
+//
+//  Football360 Exporter
+//
+//  Author : Igor Janos
+//
+//-----------------------------------------------------------------------------
+#include "pch.h"
+
+
+//-----------------------------------------------------------------------------
+//
+//  Row kernels for AVX-512. Same eight lane paths as the AVX2 set, with
+//  the EVEX encoding and 32 registers, and the compiler free to use
+//  AVX-512 in the plain loops. Only the functions from here on get the
+//  target.
+//
+//-----------------------------------------------------------------------------
+
+#ifdef KERNEL_X86
+
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx2,fma,avx512f,avx512vl,avx512bw,avx512dq"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2,fma,avx512f,avx512vl,avx512bw,avx512dq")
+#endif
+
+#define KERNEL_AVX2
+#include "cpukernelrows.h"
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+namespace Exporter {
+
+// Only after the CPU check - variantKernels() above is built for the target
+const KernelSet *kernelsAVX512()
+{
+    static const KernelSet  kernels = variantKernels("avx512");
+    return &kernels;
+}
+
+}
+
+#else
+
+namespace Exporter {
+
+const KernelSet *kernelsAVX512()
+{
+    return nullptr;
+}
+
+}
+
+#endif
@@ -0,0 +1,716 @@
+//-----------------------------------------------------------------------------
+//
+//  Football360 Exporter
+//
+//  Author : Igor Janos
+//
+//-----------------------------------------------------------------------------
+#ifndef CPUKERNELROWS_H
+#define CPUKERNELROWS_H
+
+// Eight lane math of the AVX2 builds
+#include "fastmath.h"
+
+
+namespace Exporter {
+
+//-----------------------------------------------------------------------------
+//
+//  Row kernels
+//
+//  Compiled once per instruction set - by cpukernel.cpp for the baseline
+//  and by the cpukernel<isa>.cpp variants with their target enabled,
+//  where KERNEL_AVX2 turns on the eight lane paths. Everything is static,
+//  each variant keeps its own copy and only hands out its KernelSet.
+//
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+//
+//  Scalar kernel
+//
+//-----------------------------------------------------------------------------
+
+static inline void blendTexels(uint32_t p00, uint32_t p10, uint32_t p01, uint32_t p11,
+                               float ax, float ay, float &r, float &g, float &b)
+{
+    float   w00 = (1.0f - ax) * (1.0f - ay);
+    float   w10 = ax * (1.0f - ay);
+    float   w01 = (1.0f - ax) * ay;
+    float   w11 = ax * ay;
+
+    // BGRA in memory
+    auto channel = [&](int shift) {
+        return (((p00 >> shift) & 0xff) * w00 + ((p10 >> shift) & 0xff) * w10 +
+                ((p01 >> shift) & 0xff) * w01 + ((p11 >> shift) & 0xff) * w11) * (1.0f / 255.0f);
+    };
+    b = channel(0);
+    g = channel(8);
+    r = channel(16);
+}
+
+// Texel (x, y) at texelRow(y) + texelCol(x)
+static inline size_t texelRow(const KernelPanorama &pano, int y)
+{
+    if (pano.layout == KernelPanorama::LAYOUT_BLOCKED) {
+        return (size_t)(y >> KernelPanorama::BLOCK_SHIFT) * pano.stride +
+               ((y & (KernelPanorama::BLOCK - 1)) << KernelPanorama::BLOCK_SHIFT);
+    }
+    return (size_t)y * pano.stride;
+}
+
+static inline int texelCol(const KernelPanorama &pano, int x)
+{
+    if (pano.layout == KernelPanorama::LAYOUT_BLOCKED) {
+        return ((x & ~(KernelPanorama::BLOCK - 1)) << KernelPanorama::BLOCK_SHIFT) |
+               (x & (KernelPanorama::BLOCK - 1));
+    }
+    return x;
+}
+
+static inline void sampleBilinear(const KernelPanorama &pano, float u, float v,
+                                  float &r, float &g, float &b)
+{
+    // Texel centers at half integers, GL_REPEAT on both axes
+    float   fx = u * pano.width - 0.5f;
+    float   fy = v * pano.height - 0.5f;
+    float   x0f = floorf(fx);
+    float   y0f = floorf(fy);
+    float   ax = fx - x0f;
+    float   ay = fy - y0f;
+
+    int     x0 = (int)x0f;
+    int     y0 = (int)y0f;
+    x0 = ((x0 % pano.width) + pano.width) % pano.width;
+    y0 = ((y0 % pano.height) + pano.height) % pano.height;
+    int     x1 = (x0 + 1 == pano.width ? 0 : x0 + 1);
+    int     y1 = (y0 + 1 == pano.height ? 0 : y0 + 1);
+
+    size_t      row0 = texelRow(pano, y0);
+    size_t      row1 = texelRow(pano, y1);
+    uint32_t    p00 = pano.pixels[row0 + texelCol(pano, x0)];
+    uint32_t    p10 = pano.pixels[row0 + texelCol(pano, x1)];
+    uint32_t    p01 = pano.pixels[row1 + texelCol(pano, x0)];
+    uint32_t    p11 = pano.pixels[row1 + texelCol(pano, x1)];
+
+    blendTexels(p00, p10, p01, p11, ax, ay, r, g, b);
+}
+
+// Cube face by the major axis, same selection as GL_TEXTURE_CUBE_MAP
+static inline void sampleCube(const KernelPanorama &pano, float rx, float ry, float rz,
+                              float &r, float &g, float &b)
+{
+    float   ax = fabsf(rx);
+    float   ay = fabsf(ry);
+    float   az = fabsf(rz);
+    float   ma, sc, tc;
+    int     face;
+
+    if (ax >= ay && ax >= az) {
+        face = (rx > 0.0f ? 0 : 1);
+        ma = ax;
+        sc = (rx > 0.0f ? -rz : rz);
+        tc = -ry;
+    } else
+    if (ay >= az) {
+        face = (ry > 0.0f ? 2 : 3);
+        ma = ay;
+        sc = rx;
+        tc = (ry > 0.0f ? rz : -rz);
+    } else {
+        face = (rz > 0.0f ? 4 : 5);
+        ma = az;
+        sc = (rz > 0.0f ? rx : -rx);
+        tc = -ry;
+    }
+
+    // Face texels behind a gutter of their neighbours, no wrapping
+    float   im = 0.5f / ma;
+    float   last = (float)(pano.stride - 1);
+    float   fx = (sc * im + 0.5f) * pano.width - 0.5f + KernelPanorama::CUBE_GUTTER;
+    float   fy = (tc * im + 0.5f) * pano.height - 0.5f + KernelPanorama::CUBE_GUTTER;
+    fx = std::min(std::max(fx, 0.0f), last);
+    fy = std::min(std::max(fy, 0.0f), last);
+
+    int     x0 = std::min((int)fx, pano.stride - 2);
+    int     y0 = std::min((int)fy, pano.stride - 2);
+    float   wx = fx - x0;
+    float   wy = fy - y0;
+
+    const uint32_t  *p = pano.pixels + (size_t)face * pano.stride * pano.stride + (size_t)y0 * pano.stride + x0;
+    blendTexels(p[0], p[1], p[pano.stride], p[pano.stride + 1], wx, wy, r, g, b);
+}
+
+static void reprojectSpan(const KernelView &view, const KernelPanorama &pano, int y, int x0,
+                          float *r, float *g, float *b)
+{
+    const float *m = view.rk;
+    float   cx = 0.5f * view.canvasX;
+    float   cy = 0.5f * view.canvasY;
+    float   iy0 = ((y + 0.5f) / view.height) * view.canvasY;
+
+    const float *gx = (view.grid ? view.grid + (size_t)y * 2 * view.width : nullptr);
+    const float *gy = (gx ? gx + view.width : nullptr);
+
+    for (int x=x0; x<view.width; x++) {
+        float ix = ((x + 0.5f) / view.width) * view.canvasX;
+        float iy = iy0;
+
+        // distort()
+        if (gx) {
+            ix = gx[x];
+            iy = gy[x];
+        } else
+        if (view.distortion) {
+            float px = ix - cx;
+            float py = iy - cy;
+            float rd = sqrtf(px*px + py*py);
+            float d = (rd > 0.0f ? undistortRadius(rd, view.k1, view.k2) / rd : 1.0f);
+            ix = cx + px * d;
+            iy = cy + py * d;
+        }
+
+        // reproject() - atan2 does not care about the normalization
+        float rx = m[0]*ix + m[1]*iy + m[2];
+        float ry = m[3]*ix + m[4]*iy + m[5];
+        float rz = m[6]*ix + m[7]*iy + m[8];
+
+        if (pano.layout == KernelPanorama::LAYOUT_CUBE) {
+            sampleCube(pano, rx, ry, rz, r[x], g[x], b[x]);
+            continue;
+        }
+
+        // The tail of a vector row takes the same polynomial as its body
+#ifdef KERNEL_AVX2
+        float theta = fastAtan2(rx, rz);
+        float phi = fastAtan2(ry, sqrtf(rx*rx + rz*rz));
+#else
+        float theta = atan2f(rx, rz);
+        float phi = atan2f(ry, sqrtf(rx*rx + rz*rz));
+#endif
+        float u = (theta / (float)M_PI + 1.0f) / 2.0f;
+        float v = (phi + (float)M_PI_2) / (float)M_PI;
+
+        sampleBilinear(pano, u, v, r[x], g[x], b[x]);
+    }
+}
+
+static void distortSpan(const KernelView &view, int y, int x0, float *ix, float *iy)
+{
+    float   cx = 0.5f * view.canvasX;
+    float   cy = 0.5f * view.canvasY;
+    float   iy0 = ((y + 0.5f) / view.height) * view.canvasY;
+
+    // Same steps as reprojectSpan
+    for (int x=x0; x<view.width; x++) {
+        ix[x] = ((x + 0.5f) / view.width) * view.canvasX;
+        iy[x] = iy0;
+
+        if (view.distortion) {
+            float px = ix[x] - cx;
+            float py = iy[x] - cy;
+            float rd = sqrtf(px*px + py*py);
+            float d = (rd > 0.0f ? undistortRadius(rd, view.k1, view.k2) / rd : 1.0f);
+            ix[x] = cx + px * d;
+            iy[x] = cy + py * d;
+        }
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+//
+//  Color stage of default.frag
+//
+//-----------------------------------------------------------------------------
+
+static inline float fract(float x)
+{
+    return x - floorf(x);
+}
+
+static inline float clamp01(float x)
+{
+    return std::min(std::max(x, 0.0f), 1.0f);
+}
+
+static inline float hash(float px, float py)
+{
+    return fract(sinf(px * 12.9898f + py * 78.233f) * 43758.5453f);
+}
+
+static inline float gaussNoise(float px, float py, float seed)
+{
+    float u1 = std::max(hash(px + seed * 1013.0f, py + seed * 1013.0f), 1.0e-6f);
+    float u2 = hash(py + seed * 2027.0f + 17.0f, px + seed * 2027.0f + 17.0f);
+    return sqrtf(-2.0f * logf(u1)) * cosf(2.0f * (float)M_PI * u2);
+}
+
+static inline void rgb2hsv(float r, float g, float b, float &h, float &s, float &v)
+{
+    // Same branchless form as the shader, the mix()es are selections
+    float p[4], q[4];
+    if (g >= b) {
+        p[0] = g; p[1] = b; p[2] = 0.0f; p[3] = -1.0f / 3.0f;
+    } else {
+        p[0] = b; p[1] = g; p[2] = -1.0f; p[3] = 2.0f / 3.0f;
+    }
+    if (r >= p[0]) {
+        q[0] = r; q[1] = p[1]; q[2] = p[3]; q[3] = p[0];
+    } else {
+        q[0] = p[0]; q[1] = p[1]; q[2] = p[2]; q[3] = r;
+    }
+
+    float d = q[0] - std::min(q[3], q[1]);
+    float e = 1.0e-10f;
+    h = fabsf(q[2] + (q[3] - q[1]) / (6.0f * d + e));
+    s = d / (q[0] + e);
+    v = q[0];
+}
+
+static inline void hsv2rgb(float h, float s, float v, float &r, float &g, float &b)
+{
+    float pr = fabsf(fract(h + 1.0f) * 6.0f - 3.0f);
+    float pg = fabsf(fract(h + 2.0f / 3.0f) * 6.0f - 3.0f);
+    float pb = fabsf(fract(h + 1.0f / 3.0f) * 6.0f - 3.0f);
+
+    r = v * (1.0f + s * (clamp01(pr - 1.0f) - 1.0f));
+    g = v * (1.0f + s * (clamp01(pg - 1.0f) - 1.0f));
+    b = v * (1.0f + s * (clamp01(pb - 1.0f) - 1.0f));
+}
+
+static inline uint8_t toByte(float c)
+{
+    return (uint8_t)(clamp01(c) * 255.0f + 0.5f);
+}
+
+
+#ifdef KERNEL_AVX2
+
+//-----------------------------------------------------------------------------
+//
+//  AVX2 kernel
+//
+//-----------------------------------------------------------------------------
+
+// Inverse poly-2p by Newton, lanes stop where the derivative vanishes
+static inline __m256 undistortRate_avx2(__m256 rd, __m256 k1, __m256 k2)
+{
+    const __m256    one = _mm256_set1_ps(1.0f);
+    __m256  rd2 = _mm256_mul_ps(rd, rd);
+    __m256  s = _mm256_fmadd_ps(_mm256_mul_ps(k2, rd2), rd2, _mm256_fmadd_ps(k1, rd2, one));
+    __m256  r = _mm256_blendv_ps(rd, _mm256_div_ps(rd, s),
+                                 _mm256_cmp_ps(s, _mm256_set1_ps(0.1f), _CMP_GT_OQ));
+    __m256  active = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+    for (int i=0; i<4; i++) {
+        __m256  r2 = _mm256_mul_ps(r, r);
+        __m256  r4 = _mm256_mul_ps(r2, r2);
+        __m256  fr = _mm256_fmsub_ps(r, _mm256_fmadd_ps(k2, r4, _mm256_fmadd_ps(k1, r2, one)), rd);
+        __m256  df = _mm256_fmadd_ps(_mm256_mul_ps(_mm256_set1_ps(5.0f), k2), r4,
+                                     _mm256_fmadd_ps(_mm256_mul_ps(_mm256_set1_ps(3.0f), k1), r2, one));
+        active = _mm256_and_ps(active, _mm256_cmp_ps(df, _mm256_set1_ps(1e-6f), _CMP_GT_OQ));
+        __m256  step = _mm256_div_ps(fr, df);
+        r = _mm256_sub_ps(r, _mm256_and_ps(step, active));
+    }
+
+    // r / rd, 1 at the center
+    __m256  center = _mm256_cmp_ps(rd, _mm256_setzero_ps(), _CMP_LE_OQ);
+    return _mm256_blendv_ps(_mm256_div_ps(r, rd), one, center);
+}
+
+static inline void blendTexels_avx2(__m256i p00, __m256i p10, __m256i p01, __m256i p11,
+                                    __m256 ax, __m256 ay, __m256 &r, __m256 &g, __m256 &b)
+{
+    const __m256i   mask = _mm256_set1_epi32(0xff);
+    __m256  one = _mm256_set1_ps(1.0f);
+    __m256  bx = _mm256_sub_ps(one, ax);
+    __m256  by = _mm256_sub_ps(one, ay);
+    __m256  w00 = _mm256_mul_ps(bx, by);
+    __m256  w10 = _mm256_mul_ps(ax, by);
+    __m256  w01 = _mm256_mul_ps(bx, ay);
+    __m256  w11 = _mm256_mul_ps(ax, ay);
+
+    auto channel = [&](int shift) {
+        __m256  c00 = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(p00, shift), mask));
+        __m256  c10 = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(p10, shift), mask));
+        __m256  c01 = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(p01, shift), mask));
+        __m256  c11 = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(p11, shift), mask));
+        __m256  c = _mm256_mul_ps(c00, w00);
+        c = _mm256_fmadd_ps(c10, w10, c);
+        c = _mm256_fmadd_ps(c01, w01, c);
+        c = _mm256_fmadd_ps(c11, w11, c);
+        return _mm256_mul_ps(c, _mm256_set1_ps(1.0f / 255.0f));
+    };
+    b = channel(0);
+    g = channel(8);
+    r = channel(16);
+}
+
+static inline void sampleBilinear_avx2(const KernelPanorama &pano, __m256 u, __m256 v,
+                                       __m256 &r, __m256 &g, __m256 &b)
+{
+    const __m256i   w = _mm256_set1_epi32(pano.width);
+    const __m256i   h = _mm256_set1_epi32(pano.height);
+    const __m256i   zero = _mm256_setzero_si256();
+
+    __m256  fx = _mm256_fmsub_ps(u, _mm256_set1_ps((float)pano.width), _mm256_set1_ps(0.5f));
+    __m256  fy = _mm256_fmsub_ps(v, _mm256_set1_ps((float)pano.height), _mm256_set1_ps(0.5f));
+    __m256  x0f = _mm256_floor_ps(fx);
+    __m256  y0f = _mm256_floor_ps(fy);
+    __m256  ax = _mm256_sub_ps(fx, x0f);
+    __m256  ay = _mm256_sub_ps(fy, y0f);
+
+    // u, v are within 0..1, one wrap at most
+    __m256i x0 = _mm256_cvtps_epi32(x0f);
+    __m256i y0 = _mm256_cvtps_epi32(y0f);
+    x0 = _mm256_add_epi32(x0, _mm256_and_si256(_mm256_cmpgt_epi32(zero, x0), w));
+    y0 = _mm256_add_epi32(y0, _mm256_and_si256(_mm256_cmpgt_epi32(zero, y0), h));
+    x0 = _mm256_sub_epi32(x0, _mm256_andnot_si256(_mm256_cmpgt_epi32(w, x0), w));
+    y0 = _mm256_sub_epi32(y0, _mm256_andnot_si256(_mm256_cmpgt_epi32(h, y0), h));
+
+    __m256i x1 = _mm256_add_epi32(x0, _mm256_set1_epi32(1));
+    __m256i y1 = _mm256_add_epi32(y0, _mm256_set1_epi32(1));
+    x1 = _mm256_andnot_si256(_mm256_cmpeq_epi32(x1, w), x1);
+    y1 = _mm256_andnot_si256(_mm256_cmpeq_epi32(y1, h), y1);
+
+    __m256i stride = _mm256_set1_epi32(pano.stride);
+    __m256i row0, row1;
+    if (pano.layout == KernelPanorama::LAYOUT_BLOCKED) {
+        // (y / B) * stride + (y % B) * B, (x / B) * B * B + x % B
+        const __m256i   low = _mm256_set1_epi32(KernelPanorama::BLOCK - 1);
+        const int       shift = KernelPanorama::BLOCK_SHIFT;
+        row0 = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(y0, shift), stride),
+                                _mm256_slli_epi32(_mm256_and_si256(y0, low), shift));
+        row1 = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(y1, shift), stride),
+                                _mm256_slli_epi32(_mm256_and_si256(y1, low), shift));
+        x0 = _mm256_or_si256(_mm256_slli_epi32(_mm256_andnot_si256(low, x0), shift), _mm256_and_si256(x0, low));
+        x1 = _mm256_or_si256(_mm256_slli_epi32(_mm256_andnot_si256(low, x1), shift), _mm256_and_si256(x1, low));
+    } else {
+        row0 = _mm256_mullo_epi32(y0, stride);
+        row1 = _mm256_mullo_epi32(y1, stride);
+    }
+
+    const int   *base = (const int*)pano.pixels;
+    __m256i p00 = _mm256_i32gather_epi32(base, _mm256_add_epi32(row0, x0), 4);
+    __m256i p10 = _mm256_i32gather_epi32(base, _mm256_add_epi32(row0, x1), 4);
+    __m256i p01 = _mm256_i32gather_epi32(base, _mm256_add_epi32(row1, x0), 4);
+    __m256i p11 = _mm256_i32gather_epi32(base, _mm256_add_epi32(row1, x1), 4);
+
+    blendTexels_avx2(p00, p10, p01, p11, ax, ay, r, g, b);
+}
+
+static inline void sampleCube_avx2(const KernelPanorama &pano, __m256 rx, __m256 ry, __m256 rz,
+                                   __m256 &r, __m256 &g, __m256 &b)
+{
+    const __m256    sign = _mm256_set1_ps(-0.0f);
+    const __m256    zero = _mm256_setzero_ps();
+    __m256  ax = _mm256_andnot_ps(sign, rx);
+    __m256  ay = _mm256_andnot_ps(sign, ry);
+    __m256  az = _mm256_andnot_ps(sign, rz);
+
+    // Major axis, ties like the scalar select
+    __m256  xMajor = _mm256_and_ps(_mm256_cmp_ps(ax, ay, _CMP_GE_OQ), _mm256_cmp_ps(ax, az, _CMP_GE_OQ));
+    __m256  yMajor = _mm256_andnot_ps(xMajor, _mm256_cmp_ps(ay, az, _CMP_GE_OQ));
+    __m256  xPos = _mm256_cmp_ps(rx, zero, _CMP_GT_OQ);
+    __m256  yPos = _mm256_cmp_ps(ry, zero, _CMP_GT_OQ);
+    __m256  zPos = _mm256_cmp_ps(rz, zero, _CMP_GT_OQ);
+    __m256  nrx = _mm256_xor_ps(rx, sign);
+    __m256  nry = _mm256_xor_ps(ry, sign);
+    __m256  nrz = _mm256_xor_ps(rz, sign);
+
+    // z major by default
+    __m256  ma = az;
+    __m256  sc = _mm256_blendv_ps(nrx, rx, zPos);
+    __m256  tc = nry;
+    __m256  face = _mm256_blendv_ps(_mm256_set1_ps(5.0f), _mm256_set1_ps(4.0f), zPos);
+
+    ma = _mm256_blendv_ps(ma, ay, yMajor);
+    sc = _mm256_blendv_ps(sc, rx, yMajor);
+    tc = _mm256_blendv_ps(tc, _mm256_blendv_ps(nrz, rz, yPos), yMajor);
+    face = _mm256_blendv_ps(face, _mm256_blendv_ps(_mm256_set1_ps(3.0f), _mm256_set1_ps(2.0f), yPos), yMajor);
+
+    ma = _mm256_blendv_ps(ma, ax, xMajor);
+    sc = _mm256_blendv_ps(sc, _mm256_blendv_ps(rz, nrz, xPos), xMajor);
+    tc = _mm256_blendv_ps(tc, nry, xMajor);
+    face = _mm256_blendv_ps(face, _mm256_blendv_ps(_mm256_set1_ps(1.0f), _mm256_set1_ps(0.0f), xPos), xMajor);
+
+    // One divide for both face coordinates
+    __m256  im = _mm256_div_ps(_mm256_set1_ps(0.5f), ma);
+    __m256  size = _mm256_set1_ps((float)pano.width);
+    __m256  offset = _mm256_set1_ps(KernelPanorama::CUBE_GUTTER - 0.5f);
+    __m256  half = _mm256_set1_ps(0.5f);
+    __m256  last = _mm256_set1_ps((float)(pano.stride - 1));
+    __m256  fx = _mm256_fmadd_ps(_mm256_fmadd_ps(sc, im, half), size, offset);
+    __m256  fy = _mm256_fmadd_ps(_mm256_fmadd_ps(tc, im, half), size, offset);
+    fx = _mm256_min_ps(_mm256_max_ps(fx, zero), last);
+    fy = _mm256_min_ps(_mm256_max_ps(fy, zero), last);
+
+    __m256i limit = _mm256_set1_epi32(pano.stride - 2);
+    __m256i x0 = _mm256_min_epi32(_mm256_cvttps_epi32(fx), limit);
+    __m256i y0 = _mm256_min_epi32(_mm256_cvttps_epi32(fy), limit);
+    __m256  wx = _mm256_sub_ps(fx, _mm256_cvtepi32_ps(x0));
+    __m256  wy = _mm256_sub_ps(fy, _mm256_cvtepi32_ps(y0));
+
+    __m256i stride = _mm256_set1_epi32(pano.stride);
+    __m256i faceSize = _mm256_set1_epi32(pano.stride * pano.stride);
+    __m256i index = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_cvtps_epi32(face), faceSize),
+                                     _mm256_add_epi32(_mm256_mullo_epi32(y0, stride), x0));
+
+    const int   *base = (const int*)pano.pixels;
+    __m256i p00 = _mm256_i32gather_epi32(base, index, 4);
+    __m256i p10 = _mm256_i32gather_epi32(base + 1, index, 4);
+    __m256i p01 = _mm256_i32gather_epi32(base + pano.stride, index, 4);
+    __m256i p11 = _mm256_i32gather_epi32(base + pano.stride + 1, index, 4);
+
+    blendTexels_avx2(p00, p10, p01, p11, wx, wy, r, g, b);
+}
+
+// distort() of the eight pixels from x on, row y
+static inline void distort_avx2(const KernelView &view, int y, int x, __m256 &ix, __m256 &iy)
+{
+    __m256  stepX = _mm256_set1_ps(view.canvasX / view.width);
+    __m256  lane = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+
+    ix = _mm256_mul_ps(_mm256_add_ps(_mm256_set1_ps((float)x), lane), stepX);
+    iy = _mm256_set1_ps(((y + 0.5f) / view.height) * view.canvasY);
+
+    if (view.distortion) {
+        __m256  cx = _mm256_set1_ps(0.5f * view.canvasX);
+        __m256  cy = _mm256_set1_ps(0.5f * view.canvasY);
+        __m256  px = _mm256_sub_ps(ix, cx);
+        __m256  py = _mm256_sub_ps(iy, cy);
+        __m256  rd = _mm256_sqrt_ps(_mm256_fmadd_ps(px, px, _mm256_mul_ps(py, py)));
+        __m256  d = undistortRate_avx2(rd, _mm256_set1_ps(view.k1), _mm256_set1_ps(view.k2));
+        ix = _mm256_fmadd_ps(px, d, cx);
+        iy = _mm256_fmadd_ps(py, d, cy);
+    }
+}
+
+static void distortRowAVX2(const KernelView &view, int y, float *ix, float *iy)
+{
+    int x = 0;
+    for (; x + 8 <= view.width; x += 8) {
+        __m256  vx, vy;
+        distort_avx2(view, y, x, vx, vy);
+        _mm256_storeu_ps(ix + x, vx);
+        _mm256_storeu_ps(iy + x, vy);
+    }
+
+    distortSpan(view, y, x, ix, iy);
+}
+
+static void reprojectRowAVX2(const KernelView &view, const KernelPanorama &pano, int y,
+                             float *r, float *g, float *b)
+{
+    const float *m = view.rk;
+    const float *gx = (view.grid ? view.grid + (size_t)y * 2 * view.width : nullptr);
+    const float *gy = (gx ? gx + view.width : nullptr);
+
+    const __m256    invPi = _mm256_set1_ps((float)(1.0 / M_PI));
+    const __m256    half = _mm256_set1_ps(0.5f);
+
+    int x = 0;
+    for (; x + 8 <= view.width; x += 8) {
+        __m256  ix, iy;
+        if (gx) {
+            ix = _mm256_loadu_ps(gx + x);
+            iy = _mm256_loadu_ps(gy + x);
+        } else {
+            distort_avx2(view, y, x, ix, iy);
+        }
+
+        __m256  rx = _mm256_fmadd_ps(_mm256_set1_ps(m[0]), ix, _mm256_fmadd_ps(_mm256_set1_ps(m[1]), iy, _mm256_set1_ps(m[2])));
+        __m256  ry = _mm256_fmadd_ps(_mm256_set1_ps(m[3]), ix, _mm256_fmadd_ps(_mm256_set1_ps(m[4]), iy, _mm256_set1_ps(m[5])));
+        __m256  rz = _mm256_fmadd_ps(_mm256_set1_ps(m[6]), ix, _mm256_fmadd_ps(_mm256_set1_ps(m[7]), iy, _mm256_set1_ps(m[8])));
+
+        __m256  cr, cg, cb;
+        if (pano.layout == KernelPanorama::LAYOUT_CUBE) {
+            sampleCube_avx2(pano, rx, ry, rz, cr, cg, cb);
+            _mm256_storeu_ps(r + x, cr);
+            _mm256_storeu_ps(g + x, cg);
+            _mm256_storeu_ps(b + x, cb);
+            continue;
+        }
+
+        __m256  theta = fastAtan2_avx2(rx, rz);
+        __m256  phi = fastAtan2_avx2(ry, _mm256_sqrt_ps(_mm256_fmadd_ps(rx, rx, _mm256_mul_ps(rz, rz))));
+
+        // (theta / PI + 1) / 2, (phi + PI/2) / PI
+        __m256  u = _mm256_fmadd_ps(theta, _mm256_mul_ps(invPi, half), half);
+        __m256  v = _mm256_fmadd_ps(phi, invPi, half);
+
+        sampleBilinear_avx2(pano, u, v, cr, cg, cb);
+        _mm256_storeu_ps(r + x, cr);
+        _mm256_storeu_ps(g + x, cg);
+        _mm256_storeu_ps(b + x, cb);
+    }
+
+    // Tail of the row
+    reprojectSpan(view, pano, y, x, r, g, b);
+}
+
+#endif
+
+
+//-----------------------------------------------------------------------------
+//
+//  Kernel set
+//
+//-----------------------------------------------------------------------------
+
+static void variantReprojectRow(const KernelView &view, const KernelPanorama &pano, int y,
+                                float *r, float *g, float *b)
+{
+#ifdef KERNEL_AVX2
+    reprojectRowAVX2(view, pano, y, r, g, b);
+#else
+    reprojectSpan(view, pano, y, 0, r, g, b);
+#endif
+}
+
+static void variantDistortRow(const KernelView &view, int y, float *ix, float *iy)
+{
+#ifdef KERNEL_AVX2
+    distortRowAVX2(view, y, ix, iy);
+#else
+    distortSpan(view, y, 0, ix, iy);
+#endif
+}
+
+static void variantColorRow(const KernelColor &c, int y, float *r, float *g, float *b)
+{
+    float   ty = (y + 0.5f) / c.height;
+    float   dy = (ty - 0.5f) * c.canvasY;
+    float   norm = 0.25f * (c.canvasX*c.canvasX + c.canvasY*c.canvasY);
+    float   ig = 1.0f / c.gamma;
+
+    // One noise sample per stored pixel, the area filter keeps its sigma
+    float   nsx = (float)c.noiseWidth / c.width;
+    float   ny = floorf(ty * c.noiseHeight);
+
+    for (int x=0; x<c.width; x++) {
+        float   cr, cg, cb;
+
+        // HSV
+        float   hh, ss, vv;
+        rgb2hsv(r[x], g[x], b[x], hh, ss, vv);
+        hh = fract(hh + c.hue);
+        ss = clamp01(ss * c.saturation);
+        vv = clamp01(vv * c.value);
+        hsv2rgb(hh, ss, vv, cr, cg, cb);
+
+        // gamma correction
+        cr = powf(cr, ig);
+        cg = powf(cg, ig);
+        cb = powf(cb, ig);
+
+        // vignetting
+        float   dx = ((x + 0.5f) / c.width - 0.5f) * c.canvasX;
+        float   fall = 1.0f - c.vignetting * (dx*dx + dy*dy) / norm;
+        cr *= fall;
+        cg *= fall;
+        cb *= fall;
+
+        // sensor noise
+        if (c.noise > 0.0f) {
+            float n = c.noise * gaussNoise(floorf((x + 0.5f) * nsx), ny, c.seed);
+            cr += n;
+            cg += n;
+            cb += n;
+        }
+
+        // the render target clamps
+        r[x] = clamp01(cr);
+        g[x] = clamp01(cg);
+        b[x] = clamp01(cb);
+    }
+}
+
+static void variantAccumulateRow(const AreaTaps &taps, float wy,
+                                 const float *r, const float *g, const float *b,
+                                 float *accR, float *accG, float *accB)
+{
+    int n = (int)taps.first.size() - 1;
+    for (int i=0; i<n; i++) {
+        float   sr = 0.0f, sg = 0.0f, sb = 0.0f;
+        for (int t=taps.first[i]; t<taps.first[i+1]; t++) {
+            int     x = taps.src[t];
+            float   w = taps.weight[t];
+            sr += w * r[x];
+            sg += w * g[x];
+            sb += w * b[x];
+        }
+        accR[i] += wy * sr;
+        accG[i] += wy * sg;
+        accB[i] += wy * sb;
+    }
+}
+
+static void variantPackRow(const float *r, const float *g, const float *b, int w, uint8_t *dst)
+{
+    for (int x=0; x<w; x++) {
+        dst[3*x + 0] = toByte(b[x]);
+        dst[3*x + 1] = toByte(g[x]);
+        dst[3*x + 2] = toByte(r[x]);
+    }
+}
+
+static void variantAtan2(const float *y, const float *x, float *out, int n)
+{
+    int i = 0;
+#ifdef KERNEL_AVX2
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(out + i, fastAtan2_avx2(_mm256_loadu_ps(y + i), _mm256_loadu_ps(x + i)));
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = fastAtan2(y[i], x[i]);
+    }
+}
+
+static void variantAsin(const float *x, float *out, int n)
+{
+    int i = 0;
+#ifdef KERNEL_AVX2
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(out + i, fastAsin_avx2(_mm256_loadu_ps(x + i)));
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = fastAsin(x[i]);
+    }
+}
+
+static void variantRsqrt(const float *x, float *out, int n)
+{
+    int i = 0;
+#ifdef KERNEL_AVX2
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(out + i, fastRsqrt_avx2(_mm256_loadu_ps(x + i)));
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = fastRsqrt(x[i]);
+    }
+}
+
+static KernelSet variantKernels(const char *isa)
+{
+    KernelSet   k;
+    k.isa = isa;
+    k.reprojectRow = variantReprojectRow;
+    k.distortRow = variantDistortRow;
+    k.colorRow = variantColorRow;
+    k.accumulateRow = variantAccumulateRow;
+    k.packRow = variantPackRow;
+    k.fastAtan2 = variantAtan2;
+    k.fastAsin = variantAsin;
+    k.fastRsqrt = variantRsqrt;
+    return k;
+}
+
+
+}
+
+#endif // CPUKERNELROWS_H
@@ -0,0 +1,401 @@
+//-----------------------------------------------------------------------------
+//
+//  Football360 Exporter
+//
+//  Author : Igor Janos
+//
+//-----------------------------------------------------------------------------
+#include "pch.h"
+
+
+namespace Exporter {
+
+
+
+//-----------------------------------------------------------------------------
+//
+//  RayGridCache
+//
+//-----------------------------------------------------------------------------
+
+RayGridCache::RayGridCache(QSize size, QVector2D acanvas, int acapacity, float astep) :
+    renderSize(size),
+    canvas(acanvas),
+    capacity(qMax(1, acapacity)),
+    step(astep),
+    stamp(0),
+    hits(0),
+    misses(0)
+{
+    double mb = 2.0 * sizeof(float) * size.width() * size.height() / (1024.0 * 1024.0);
+    printf("Ray cache : %d grids x %.1f MB\n", capacity, mb);
+}
+
+void RayGridCache::quantize(CropSample &s)
+{
+    if (step <= 0.0f) return ;
+    s.k1 = qRound(s.k1 / step) * step;
+    s.k2 = qRound(s.k2 / step) * step;
+}
+
+RayGridCache::Grid RayGridCache::build(float k1, float k2)
+{
+    KernelView  view;
+    memset(&view, 0, sizeof(view));
+    view.canvasX = canvas.x();
+    view.canvasY = canvas.y();
+    view.k1 = k1;
+    view.k2 = k2;
+    view.distortion = true;
+    view.width = renderSize.width();
+    view.height = renderSize.height();
+
+    int     w = view.width;
+    Grid    grid = makeNew<std::vector<float>>((size_t)2 * w * view.height);
+    float   *data = grid->data();
+
+    std::vector<int>    rows(view.height);
+    for (int y=0; y<view.height; y++) rows[y] = y;
+    QtConcurrent::blockingMap(rows, [&](int y) {
+        float *gx = data + (size_t)y * 2 * w;
+        distortRow(view, y, gx, gx + w);
+    });
+
+    return grid;
+}
+
+RayGridCache::Grid RayGridCache::grid(float k1, float k2)
+{
+    stamp ++;
+
+    for (size_t i=0; i<entries.size(); i++) {
+        if (entries[i].k1 == k1 && entries[i].k2 == k2) {
+            entries[i].stamp = stamp;
+            hits ++;
+            return entries[i].grid;
+        }
+    }
+
+    Entry   e;
+    e.k1 = k1;
+    e.k2 = k2;
+    e.stamp = stamp;
+    e.grid = build(k1, k2);
+    misses ++;
+
+    // Replace the least recently used one, batches in flight keep theirs
+    if ((int)entries.size() < capacity) {
+        entries.push_back(e);
+    } else {
+        size_t  lru = 0;
+        for (size_t i=1; i<entries.size(); i++) {
+            if (entries[i].stamp < entries[lru].stamp) lru = i;
+        }
+        entries[lru] = e;
+    }
+
+    return e.grid;
+}
+
+
+//-----------------------------------------------------------------------------
+//
+//  CpuRenderer
+//
+//-----------------------------------------------------------------------------
+
+CpuRenderer::CpuRenderer(Preset *apreset) :
+    renderSize(apreset->renderSize),
+    outSize(apreset->renderSize),
+    noiseSize(apreset->noiseSize()),
+    canvas(viewCanvas(apreset->renderSize.width(), apreset->renderSize.height())),
+    batch(qMax(1, apreset->batch)),
+    lensDistortion(true),
+    colorProcessing(apreset->augment),
+    paired(apreset->paired),
+    fused(false),
+    layout(apreset->layout),
+    cubemap(apreset->projection == "cubemap"),
+    cubeSize(apreset->cubeSize),
+    renderedCrops(0)
+{
+    // Pinhole only when k is zero for every crop
+    if (apreset->distortion == "none" ||
+        (apreset->k1 == QPair<float,float>(0, 0) && apreset->epsK2 == 0)) {
+        lensDistortion = false;
+    }
+
+    if (layout != "blocked" && layout != "linear") {
+        printf("Warning: Unknown layout \"%s\", using blocked\n", layout.toLatin1().constData());
+        layout = "blocked";
+    }
+
+    // Grids only pay off with a distortion to solve
+    if (lensDistortion && apreset->rayGrids > 0) {
+        rays = makeNew<RayGridCache>(renderSize, canvas, apreset->rayGrids, apreset->rayStep);
+    }
+
+    // Area downsample fused into the render, only when it shrinks
+    QSize   ss = apreset->scaleSize;
+    if (apreset->downsample != "cpu") {
+        if (ss.width() <= renderSize.width() && ss.height() <= renderSize.height()) {
+            fused = true;
+            outSize = ss;
+            tapsX.build(renderSize.width(), ss.width());
+            tapsY.build(renderSize.height(), ss.height());
+        } else {
+            printf("Warning: scaleSize larger than renderSize, CPU renderer downsamples in the sink\n");
+        }
+    }
+
+    // Widest kernel set of this CPU, the build itself is baseline
+    printf("CPU kernels : %s\n", kernelISA());
+}
+
+CpuRenderer::~CpuRenderer()
+{
+}
+
+int CpuRenderer::contexts()
+{
+    // One batch at a time, its tiles spread over the thread pool
+    return 1;
+}
+
+int CpuRenderer::batchSize()
+{
+    return batch;
+}
+
+void CpuRenderer::prefetch(QSharedPointer<Image> aimage)
+{
+    // Decoded by the prefetcher already, converted on first use
+    Q_UNUSED(aimage);
+}
+
+void CpuRenderer::setImage(QSharedPointer<Image> aimage)
+{
+    if (image == aimage) return ;
+    image = aimage;
+
+    // JPEGs decode to RGB32, which is BGRA in memory - like the GL upload
+    panorama = image->image;
+    if (panorama.format() != QImage::Format_RGB32 && panorama.format() != QImage::Format_ARGB32) {
+        panorama = panorama.convertToFormat(QImage::Format_RGB32);
+    }
+
+    source.pixels = (const uint32_t*)panorama.constBits();
+    source.width = panorama.width();
+    source.height = panorama.height();
+    source.stride = panorama.bytesPerLine() / 4;
+    source.layout = KernelPanorama::LAYOUT_LINEAR;
+
+    // Once per panorama, the faces or rows of blocks over all cores
+    if (cubemap) {
+        cube.build(source, (cubeSize > 0 ? cubeSize : CubeMap::autoSize(source.width)));
+        source = cube.panorama();
+    } else
+    if (layout == "blocked") {
+        blocks.resize(blockedSize(source.width, source.height));
+        std::vector<int>    rows((source.height + KernelPanorama::BLOCK - 1) / KernelPanorama::BLOCK);
+        for (size_t i=0; i<rows.size(); i++) rows[i] = (int)i;
+
+        QtConcurrent::blockingMap(rows, [&](int row) {
+            blockRow(source, blocks.data(), row);
+        });
+        source = blockedPanorama(blocks.data(), source.width, source.height);
+    }
+}
+
+KernelView CpuRenderer::kernelView(const CropSample &s, bool distortion)
+{
+    KernelView  view;
+
+    cv::Mat         RK = viewRK(s, canvas);
+    const double    *m = (const double*)RK.data;
+    for (int i=0; i<9; i++) {
+        view.rk[i] = (float)m[i];
+    }
+
+    view.canvasX = canvas.x();
+    view.canvasY = canvas.y();
+    view.k1 = s.k1;
+    view.k2 = s.k2;
+    view.distortion = distortion;
+    view.width = renderSize.width();
+    view.height = renderSize.height();
+    view.grid = nullptr;
+    return view;
+}
+
+void CpuRenderer::processRow(const CropSample &s, int y, float *r, float *g, float *b)
+{
+    if (!colorProcessing) return ;
+
+    KernelColor     color;
+    color.hue = s.hue;
+    color.saturation = s.saturation;
+    color.value = s.value;
+    color.gamma = s.gamma;
+    color.noise = s.noise;
+    color.vignetting = s.vignetting;
+    color.seed = s.seed;
+    color.canvasX = canvas.x();
+    color.canvasY = canvas.y();
+    color.width = renderSize.width();
+    color.height = renderSize.height();
+    color.noiseWidth = noiseSize.width();
+    color.noiseHeight = noiseSize.height();
+
+    colorRow(color, y, r, g, b);
+}
+
+void CpuRenderer::renderTile(const KernelView &view, const CropSample &s, int row, QImage &target)
+{
+    const KernelPanorama    &pano = source;
+
+    int     w = renderSize.width();
+    std::vector<float>  rgb(3 * w);
+    float   *r = rgb.data();
+    float   *g = r + w;
+    float   *b = g + w;
+
+    int     end = qMin(row + (int)TILE_ROWS, renderSize.height());
+    for (int y=row; y<end; y++) {
+        reprojectRow(view, pano, y, r, g, b);
+        processRow(s, y, r, g, b);
+        packRow(r, g, b, w, target.scanLine(y));
+    }
+}
+
+void CpuRenderer::renderTileFused(const KernelView &view, const CropSample &s, int row, QImage &target)
+{
+    const KernelPanorama    &pano = source;
+
+    // One source row and one output row, both stay in L1 / L2
+    int     w = renderSize.width();
+    int     ow = outSize.width();
+    std::vector<float>  rgb(3 * w);
+    std::vector<float>  acc(3 * ow);
+    float   *r = rgb.data();
+    float   *g = r + w;
+    float   *b = g + w;
+    float   *ar = acc.data();
+    float   *ag = ar + ow;
+    float   *ab = ag + ow;
+
+    // Rows on the border of two output rows are rendered once
+    int     cached = -1;
+
+    int     end = qMin(row + (int)TILE_ROWS, outSize.height());
+    for (int oy=row; oy<end; oy++) {
+        std::fill(acc.begin(), acc.end(), 0.0f);
+
+        for (int t=tapsY.first[oy]; t<tapsY.first[oy+1]; t++) {
+            int y = tapsY.src[t];
+            if (y != cached) {
+                reprojectRow(view, pano, y, r, g, b);
+                processRow(s, y, r, g, b);
+                cached = y;
+            }
+            accumulateRow(tapsX, tapsY.weight[t], r, g, b, ar, ag, ab);
+        }
+
+        packRow(ar, ag, ab, ow, target.scanLine(oy));
+    }
+}
+
+void CpuRenderer::submit(QSharedPointer<Image> aimage, const std::vector<CropSample> &samples)
+{
+    if (!aimage || samples.empty()) return ;
+    setImage(aimage);
+
+    int     n = (int)samples.size();
+    QList<QSharedPointer<RenderedImage>>    frames;
+    std::vector<CropSample>     crops(samples);
+    std::vector<KernelView>     views, plainViews;
+    std::vector<RayGridCache::Grid>     grids;
+
+    for (int i=0; i<n; i++) {
+        if (rays) rays->quantize(crops[i]);
+
+        KernelView  view = kernelView(crops[i], lensDistortion);
+        if (rays) {
+            grids.push_back(rays->grid(crops[i].k1, crops[i].k2));
+            view.grid = grids.back()->data();
+        }
+
+        auto frame = makeNew<RenderedImage>();
+        frame->image = QImage(outSize, QImage::Format_BGR888);
+        frame->RK_inverse = viewRK(crops[i], canvas).inv();
+        frame->sample = crops[i];
+        if (paired) {
+            frame->undistorted = QImage(outSize, QImage::Format_BGR888);
+        }
+        frames.append(frame);
+
+        views.push_back(view);
+        plainViews.push_back(kernelView(crops[i], false));
+    }
+
+    // Row tiles of every crop of the batch, over all cores
+    std::vector<Tile>   tiles;
+    for (int i=0; i<n; i++) {
+        for (int y=0; y<outSize.height(); y += TILE_ROWS) {
+            Tile t;
+            t.crop = i;
+            t.row = y;
+            tiles.push_back(t);
+        }
+    }
+
+    QtConcurrent::blockingMap(tiles, [&](const Tile &t) {
+        if (fused) {
+            renderTileFused(views[t.crop], crops[t.crop], t.row, frames[t.crop]->image);
+            if (paired) {
+                renderTileFused(plainViews[t.crop], crops[t.crop], t.row, frames[t.crop]->undistorted);
+            }
+        } else {
+            renderTile(views[t.crop], crops[t.crop], t.row, frames[t.crop]->image);
+            if (paired) {
+                renderTile(plainViews[t.crop], crops[t.crop], t.row, frames[t.crop]->undistorted);
+            }
+        }
+    });
+
+    results.append(frames);
+    renderedCrops += n;
+}
+
+QList<QSharedPointer<RenderedImage>> CpuRenderer::collect(bool wait)
+{
+    // Rendered synchronously, nothing to wait for
+    Q_UNUSED(wait);
+
+    QList<QSharedPointer<RenderedImage>>    frames;
+    frames.swap(results);
+    return frames;
+}
+
+void CpuRenderer::finish()
+{
+}
+
+void CpuRenderer::report(ExportStats &stats)
+{
+    QStringList     options;
+    options << kernelISA() << QString("%1 threads").arg(QThreadPool::globalInstance()->maxThreadCount());
+    if (fused) options << "fused downsample";
+    if (cubemap) options << QString("cubemap %1").arg(cube.size);
+    else options << QString("%1 layout").arg(layout);
+
+    stats.renderer = QString("cpu (%1)").arg(options.join(", "));
+    if (rays) {
+        stats.rayHits = rays->hits;
+        stats.rayMisses = rays->misses;
+    }
+}
+
+
+
+}
@@ -0,0 +1,140 @@
+//-----------------------------------------------------------------------------
+//
+//  Football360 Exporter
+//
+//  Author : Igor Janos
+//
+//-----------------------------------------------------------------------------
+#ifndef CPURENDER_H
+#define CPURENDER_H
+
+
+namespace Exporter {
+
+//-----------------------------------------------------------------------------
+//
+//  CPU renderer
+//
+//  Render backend for nodes without a GPU. Crops are split into tiles
+//  of rows spread over all cores, each row goes through the SIMD
+//  reprojection kernel and the color stage of default.frag. Unless the
+//  preset asks for the CPU downsample, the area filter is fused into the
+//  tiles - rows of renderSize pixels are accumulated straight into rows
+//  of scaleSize and the full frame is never stored.
+//
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+//
+//  Ray grid cache
+//
+//  Canvas positions of every renderSize pixel after the inverse
+//  distortion, per (k1, k2). The fov and rotation only enter through
+//  R * K^-1, so one grid serves every view with the same distortion and
+//  the crops skip the Newton solve. With a step, k1 and k2 of the crops
+//  are snapped to bins of that size so random distortions share grids
+//  too. Least recently used grids are dropped.
+//
+//-----------------------------------------------------------------------------
+
+class RayGridCache
+{
+public:
+    typedef QSharedPointer<std::vector<float>>  Grid;
+
+protected:
+
+    class Entry
+    {
+    public:
+        float               k1, k2;
+        uint64_t            stamp;
+        Grid                grid;
+    };
+
+    QSize                   renderSize;
+    QVector2D               canvas;
+    int                     capacity;
+    float                   step;
+    uint64_t                stamp;
+    std::vector<Entry>      entries;
+
+    Grid build(float k1, float k2);
+
+public:
+
+    int                     hits;
+    int                     misses;
+
+public:
+    RayGridCache(QSize size, QVector2D canvas, int capacity, float step);
+
+    // Distortion of the crop on the bins, labels follow
+    void quantize(CropSample &s);
+
+    // Planar x / y rows, as KernelView::grid expects
+    Grid grid(float k1, float k2);
+};
+
+
+class CpuRenderer : public RenderBackend
+{
+protected:
+
+    enum { TILE_ROWS = 16 };
+
+    class Tile
+    {
+    public:
+        int                 crop;
+        int                 row;
+    };
+
+    QSize                   renderSize;
+    QSize                   outSize;
+    QSize                   noiseSize;
+    QVector2D               canvas;
+    int                     batch;
+    bool                    lensDistortion;
+    bool                    colorProcessing;
+    bool                    paired;
+    bool                    fused;
+    AreaTaps                tapsX, tapsY;
+    QSharedPointer<RayGridCache>    rays;
+    QString                 layout;
+    bool                    cubemap;
+    int                     cubeSize;
+
+    QSharedPointer<Image>   image;
+    QImage                  panorama;       // BGRA
+    std::vector<uint32_t>   blocks;
+    CubeMap                 cube;
+    KernelPanorama          source;         // sampled, linear or blocks
+
+    QList<QSharedPointer<RenderedImage>>    results;
+    int                     renderedCrops;
+
+    void setImage(QSharedPointer<Image> aimage);
+    KernelView kernelView(const CropSample &s, bool distortion);
+    void renderTile(const KernelView &view, const CropSample &s, int row, QImage &target);
+    void renderTileFused(const KernelView &view, const CropSample &s, int row, QImage &target);
+    void processRow(const CropSample &s, int y, float *r, float *g, float *b);
+
+public:
+    CpuRenderer(Preset *apreset);
+    virtual ~CpuRenderer();
+
+    // RenderBackend
+    virtual int contexts();
+    virtual int batchSize();
+    virtual void prefetch(QSharedPointer<Image> image);
+    virtual void submit(QSharedPointer<Image> image, const std::vector<CropSample> &samples);
+    virtual QList<QSharedPointer<RenderedImage>> collect(bool wait = false);
+    virtual void finish();
+    virtual void report(ExportStats &stats);
+};
+
+
+}
+
+#endif // CPURENDER_H
@@ -0,0 +1,79 @@
+//-----------------------------------------------------------------------------
+//
+//  Football360 Exporter
+//
+//  Author : Igor Janos
+//
+//-----------------------------------------------------------------------------
+#include "pch.h"
+
+
+namespace Exporter {
+
+
+
+//-----------------------------------------------------------------------------
+//
+//  CubeMap
+//
+//-----------------------------------------------------------------------------
+
+CubeMap::CubeMap() :
+    size(0)
+{
+}
+
+int CubeMap::autoSize(int width)
+{
+    // 90 degrees of the face against 360 of the panorama, at the
+    // face center. Multiple of 8 for the SIMD rows.
+    int s = (int)ceil(width / M_PI);
+    return (s + 7) & ~7;
+}
+
+void CubeMap::build(const KernelPanorama &equirect, int asize)
+{
+    size = asize;
+    pixels.resize(cubeStorageSize(size));
+
+    class Row
+    {
+    public:
+        int     face;
+        int     y;
+    };
+
+    std::vector<Row>    rows;
+    for (int f=0; f<KernelPanorama::CUBE_FACES; f++) {
+        for (int y=0; y<stride(); y++) {
+            Row r;
+            r.face = f;
+            r.y = y;
+            rows.push_back(r);
+        }
+    }
+
+    QtConcurrent::blockingMap(rows, [&](const Row &r) {
+        cubeFaceRow(equirect, pixels.data(), size, r.face, r.y);
+    });
+}
+
+KernelPanorama CubeMap::panorama() const
+{
+    return cubePanorama(pixels.data(), size);
+}
+
+int CubeMap::stride() const
+{
+    return size + 2 * KernelPanorama::CUBE_GUTTER;
+}
+
+const uint32_t *CubeMap::row(int face, int y) const
+{
+    int g = KernelPanorama::CUBE_GUTTER;
+    return pixels.data() + (size_t)face * stride() * stride() + (size_t)(y + g) * stride() + g;
+}
+
+
+
+}
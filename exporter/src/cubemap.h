@@ -0,0 +1,53 @@
+//-----------------------------------------------------------------------------
+//
+//  Football360 Exporter
+//
+//  Author : Igor Janos
+//
+//-----------------------------------------------------------------------------
+#ifndef CUBEMAP_H
+#define CUBEMAP_H
+
+
+namespace Exporter {
+
+//-----------------------------------------------------------------------------
+//
+//  Cube map panorama
+//
+//  Six faces resampled once from the equirectangular panorama. Sampling
+//  a face takes a major axis select and one divide instead of two
+//  inverse trig functions, and the texel density stays even towards the
+//  poles. The CPU renderer samples the faces with their gutter, the GL
+//  path uploads them into a GL_TEXTURE_CUBE_MAP.
+//
+//-----------------------------------------------------------------------------
+
+class CubeMap
+{
+public:
+
+    int                     size;           // face texels, without the gutter
+    std::vector<uint32_t>   pixels;         // BGRA, faces with the gutter
+
+public:
+    CubeMap();
+
+    // Same texel density as the equator of the panorama, 0 in the
+    // preset picks this one
+    static int autoSize(int width);
+
+    // Resample the faces over all cores
+    void build(const KernelPanorama &equirect, int asize);
+
+    KernelPanorama panorama() const;
+    int stride() const;
+
+    // First texel of row y of the face, gutter excluded
+    const uint32_t *row(int face, int y) const;
+};
+
+
+}
+
+#endif // CUBEMAP_H
@@ -14,37 +14,6 @@ namespace Exporter {
 
 
 
-double toRad(double degrees)
-{
-    return degrees * M_PI / 180.0;
-}
-
-cv::Mat RotationMatrix(double rx, double ry, double rz)
-{
-    cv::Mat R_x = (cv::Mat_<double>(3,3) <<
-            1,       0,         0,
-            0,       cos(rx),   -sin(rx),
-            0,       sin(rx),   cos(rx)
-    );
-
-    cv::Mat R_y = (cv::Mat_<double>(3,3) <<
-            cos(ry),    0,      sin(ry),
-            0,          1,      0,
-            -sin(ry),   0,      cos(ry)
-    );
-
-    cv::Mat R_z = (cv::Mat_<double>(3,3) <<
-            cos(rz),    -sin(rz),      0,
-            sin(rz),    cos(rz),       0,
-            0,          0,             1);
-
-    cv::Mat R = R_z * R_y * R_x;
-    return R;
-}
-
-
-
-
 //-----------------------------------------------------------------------------
 //
 //  DatasetImageSource
@@ -52,14 +21,19 @@ cv::Mat RotationMatrix(double rx, double ry, double rz)
 //-----------------------------------------------------------------------------
 
 DatasetImageSource::DatasetImageSource(
-        QString apath, QStringList aimages
+        QString apath, QStringList aimages,
+        QSharedPointer<CropFilter> afilter,
+        bool alargeImages
         ) :
     path(apath),
     images(aimages),
-    index(-1)
+    index(-1),
+    largeImages(alargeImages),
+    filter(afilter)
 {
 
-    QImageReader::setAllocationLimit(512 * 1024*1024);
+    // In MB, a 16K panorama takes 512
+    QImageReader::setAllocationLimit(1024);
 
 }
 
@@ -74,7 +48,24 @@ QSharedPointer<Image> DatasetImageSource::current()
 
     // load the image file
     result->filename = path + images[index];
-    result->image.load(result->filename);
+    QImageReader    reader(result->filename);
+
+    // A 32K panorama decodes to 2 GB, the limit follows the header
+    if (largeImages) {
+        QSize   s = reader.size();
+        qint64  mb = ((qint64)s.width() * s.height() * 4 >> 20) + 1;
+        QImageReader::setAllocationLimit((int)qBound<qint64>(1024, mb, INT_MAX));
+    }
+    if (!reader.read(&result->image)) {
+        printf("Error: Failed to load %s - %s\n",
+               result->filename.toLatin1().constData(),
+               reader.errorString().toLatin1().constData());
+    }
+
+    // low-res mask for rejecting crops
+    if (filter) {
+        filter->prepare(*result);
+    }
 
     return result;
 }
@@ -236,6 +227,137 @@ bool Repeater::hasCurrent()
 }
 
 
+//-----------------------------------------------------------------------------
+//
+//  Prefetcher
+//
+//-----------------------------------------------------------------------------
+
+Prefetcher::Prefetcher(
+        QSharedPointer<PipelineSource<Image>> asrc, int adepth
+        ) :
+    source(asrc),
+    depth(adepth),
+    running(false),
+    finished(false),
+    stopping(false),
+    worker(nullptr)
+{
+}
+
+Prefetcher::~Prefetcher()
+{
+    stop();
+}
+
+void Prefetcher::stop()
+{
+    if (worker) {
+        {
+            QMutexLocker    l(&lock);
+            stopping = true;
+            cond.wakeAll();
+        }
+
+        worker->wait();
+        delete worker;
+        worker = nullptr;
+    }
+
+    running = false;
+}
+
+void Prefetcher::produce()
+{
+    // The source is only touched from this thread while running
+    while (true) {
+        {
+            QMutexLocker    l(&lock);
+            while (!stopping && queue.size() > depth) {
+                cond.wait(&lock);
+            }
+            if (stopping) return ;
+        }
+
+        QSharedPointer<Image>   image;
+        bool                    atEnd = !source->hasCurrent();
+        if (!atEnd) {
+            image = source->current();
+            source->next();
+        }
+
+        QMutexLocker    l(&lock);
+        if (atEnd) {
+            finished = true;
+            cond.wakeAll();
+            return ;
+        }
+
+        queue.append(image);
+        cond.wakeAll();
+    }
+}
+
+void Prefetcher::waitForItem()
+{
+    // lock is held by the caller
+    while (running && queue.isEmpty() && !finished) {
+        cond.wait(&lock);
+    }
+}
+
+QSharedPointer<Image> Prefetcher::current()
+{
+    QMutexLocker    l(&lock);
+
+    waitForItem();
+    if (queue.isEmpty()) return nullptr;
+
+    return queue.first();
+}
+
+void Prefetcher::reset()
+{
+    stop();
+
+    queue.clear();
+    finished = false;
+    stopping = false;
+    source->reset();
+
+    running = true;
+    worker = QThread::create([this] { produce(); });
+    worker->start();
+}
+
+void Prefetcher::next()
+{
+    QMutexLocker    l(&lock);
+
+    waitForItem();
+    if (!queue.isEmpty()) {
+        queue.removeFirst();
+        cond.wakeAll();
+    }
+}
+
+bool Prefetcher::hasCurrent()
+{
+    QMutexLocker    l(&lock);
+
+    waitForItem();
+    return !queue.isEmpty();
+}
+
+QSharedPointer<Image> Prefetcher::upcoming()
+{
+    QMutexLocker    l(&lock);
+
+    if (queue.size() < 2) return nullptr;
+    return queue[1];
+}
+
+
 //-----------------------------------------------------------------------------
 //
 //  CropSample
@@ -245,13 +367,17 @@ bool Repeater::hasCurrent()
 
 CropSample::CropSample() :
     p(0), t(0), r(0), fov(45),
-    k1(0), k2(0)
+    k1(0), k2(0),
+    hue(0), saturation(1), value(1), gamma(1),
+    noise(0), vignetting(0), seed(0)
 {
 }
 
 CropSample::CropSample(const CropSample &av):
     p(av.p), t(av.t), r(av.r), fov(av.fov),
-    k1(av.k1), k2(av.k2)
+    k1(av.k1), k2(av.k2),
+    hue(av.hue), saturation(av.saturation), value(av.value), gamma(av.gamma),
+    noise(av.noise), vignetting(av.vignetting), seed(av.seed)
 {
 
 }
@@ -260,6 +386,8 @@ CropSample &CropSample::operator =(CropSample v)
 {
     p = v.p; t = v.t; r = v.r; fov = v.fov;
     k1 = v.k1; k2 = v.k2;
+    hue = v.hue; saturation = v.saturation; value = v.value; gamma = v.gamma;
+    noise = v.noise; vignetting = v.vignetting; seed = v.seed;
     return *this;
 }
 
@@ -267,96 +395,232 @@ CropSample &CropSample::operator =(CropSample v)
 
 //-----------------------------------------------------------------------------
 //
-//  InterpolatedFunction class
+//  TimingHistogram
 //
 //-----------------------------------------------------------------------------
 
-InterpolatedFunction::InterpolatedFunction() :
-    invertible(true)
+TimingHistogram::TimingHistogram() :
+    count(0),
+    total(0.0)
+{
+    for (int i=0; i<BUCKETS; i++) counts[i] = 0;
+}
+
+void TimingHistogram::add(quint64 nanoseconds)
 {
+    quint64 us = nanoseconds / 1000;
+    int     b = 0;
+    while (us > 1 && b < BUCKETS-1) {
+        us >>= 1;
+        b ++;
+    }
 
+    counts[b] ++;
+    count ++;
+    total += nanoseconds / 1000000.0;
 }
 
-void InterpolatedFunction::reset()
+void TimingHistogram::merge(const TimingHistogram &other)
 {
-    invertible = true;
-    data.clear();
-    xMin = xMax = yMin = yMax = 0.0;
+    for (int i=0; i<BUCKETS; i++) counts[i] += other.counts[i];
+    count += other.count;
+    total += other.total;
 }
 
-void InterpolatedFunction::add(float x, float y)
+double TimingHistogram::percentile(double p)
 {
-    if (data.size() == 0) {
+    quint64 target = (quint64)ceil(p * count);
+    quint64 sum = 0;
+    for (int i=0; i<BUCKETS; i++) {
+        sum += counts[i];
+        if (sum >= target) return (double)(2ull << i) / 1000.0;
+    }
+    return (double)(2ull << (BUCKETS-1)) / 1000.0;
+}
 
-        data.push_back(std::make_pair(x,y));
+void TimingHistogram::print(const char *name)
+{
+    if (count == 0) return ;
+
+    printf("   %-15s: mean %.3f ms, p50 < %.3f ms, p95 < %.3f ms (%llu)\n",
+           name, total / count, percentile(0.5), percentile(0.95),
+           (unsigned long long)count
+           );
+
+    // Non-empty buckets only
+    for (int i=0; i<BUCKETS; i++) {
+        if (counts[i] == 0) continue;
+        int bar = (int)((40 * counts[i] + count - 1) / count);
+        printf("      < %8.3f ms : %6llu %s\n",
+               (double)(2ull << i) / 1000.0, (unsigned long long)counts[i],
+               QByteArray(bar, '#').constData()
+               );
+    }
+}
 
-        xMin = x;
-        xMax = x;
-        yMin = y;
-        yMax = y;
 
-    } else {
+//-----------------------------------------------------------------------------
+//
+//  ExportStats
+//
+//-----------------------------------------------------------------------------
 
-        // prikladame len pokial je funkcia prosta
-        if (invertible) {
-            if (y > yMax) {
-                data.push_back(std::make_pair(x,y));
-                xMin = (x < xMin ? x : xMin);
-                xMax = (x > xMax ? x : xMax);
-                yMin = (y < yMin ? y : yMin);
-                yMax = (y > yMax ? y : yMax);
-            } else {
-                invertible = false;
-            }
+ExportStats::ExportStats() :
+    rendered(0),
+    failed(0),
+    rejectedDark(0),
+    rejectedNadir(0),
+    forced(0),
+    tileUploads(0),
+    tileMisses(0),
+    rayHits(0),
+    rayMisses(0)
+{
+}
+
+void ExportStats::print()
+{
+    int rejected = rejectedDark + rejectedNadir;
+    int sampled = rendered + rejected;
+
+    printf("\n");
+    printf("Export report\n");
+    printf("   rendered       : %d\n", rendered);
+    if (failed > 0) {
+        printf("   failed         : %d\n", failed);
+    }
+    printf("   rejected       : %d (%.1f%% of sampled)\n",
+           rejected, (sampled > 0 ? 100.0 * rejected / sampled : 0.0)
+           );
+    printf("      dark        : %d\n", rejectedDark);
+    printf("      nadir       : %d\n", rejectedNadir);
+    printf("   forced         : %d\n", forced);
+    if (!renderer.isEmpty()) {
+        printf("   renderer       : %s\n", renderer.toLatin1().constData());
+    }
+    if (poolBatches.size() > 0) {
+        QStringList     counts;
+        for (int i=0; i<poolBatches.size(); i++) {
+            counts << QString::number(poolBatches[i]);
         }
+        printf("   contexts       : %d (batches %s)\n",
+               (int)poolBatches.size(), counts.join(" / ").toLatin1().constData()
+               );
+    }
+    if (tileUploads > 0) {
+        printf("   tile uploads   : %d\n", tileUploads);
+        printf("   tile misses    : %d\n", tileMisses);
+    }
+    if (rayHits + rayMisses > 0) {
+        printf("   ray grids      : %d hits, %d misses (%.1f%% hit rate)\n",
+               rayHits, rayMisses, 100.0 * rayHits / (rayHits + rayMisses)
+               );
+    }
+
+    if (gpuDraw.count > 0 || gpuUpload.count > 0) {
+        printf("\n");
+        printf("GPU timings\n");
+        gpuUpload.print("upload");
+        gpuWait.print("upload wait");
+        gpuTiles.print("tiles");
+        gpuDraw.print("draw");
+        gpuDownsample.print("downsample");
+        gpuReadback.print("readback");
     }
 }
 
-std::pair<float,float> InterpolatedFunction::xRange()
+
+//-----------------------------------------------------------------------------
+//
+//  CropFilter
+//
+//-----------------------------------------------------------------------------
+
+// Mask values
+static const uchar MASK_VALID = 0;
+static const uchar MASK_DARK = 1;
+static const uchar MASK_NADIR = 2;
+
+
+CropFilter::CropFilter(Preset *apreset) :
+    renderSize(apreset->renderSize),
+    maskSize(512, 256),
+    minLuma(apreset->minLuma),
+    nadir(apreset->nadir),
+    maxInvalid(apreset->maxInvalid),
+    grid(16)
 {
-    return std::make_pair(xMin, xMax);
 }
 
-std::pair<float,float> InterpolatedFunction::yRange()
+void CropFilter::prepare(Image &image)
 {
-    return std::make_pair(yMin, yMax);
-}
+    if (image.image.isNull()) return ;
 
+    // Thumbnail luma
+    QImage thumb = image.image.scaled(
+                maskSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation
+                ).convertToFormat(QImage::Format_Grayscale8);
 
-float InterpolatedFunction::getY(float x)
-{
-    int n = data.size();
-    if (x >= xMin && x <= xMax && n >= 2) {
-        for (int i=0; i<n-1; i++) {
-            std::pair<float,float>  &cur = data[i];
-            std::pair<float,float>  &next = data[i+1];
-            if (x >= cur.first && x <= next.first) {
-                float relative = (x - cur.first) / (next.first - cur.first);
-                float y = cur.second + relative*(next.second - cur.second);
-                return y;
+    int     w = maskSize.width();
+    int     h = maskSize.height();
+    uchar   lumaLimit = (uchar)qBound(0.0f, minLuma * 255.0f, 255.0f);
+
+    image.mask = cv::Mat(h, w, CV_8UC1);
+    for (int y=0; y<h; y++) {
+        const uchar *src = thumb.constScanLine(y);
+        uchar       *dst = image.mask.ptr<uchar>(y);
+
+        // latitude below horizon, in degrees
+        float lat = ((y + 0.5f) / (float)h) * 180.0f - 90.0f;
+        bool  isNadir = (lat > nadir);
+
+        for (int x=0; x<w; x++) {
+            if (isNadir) {
+                dst[x] = MASK_NADIR;
+            } else
+            if (src[x] < lumaLimit) {
+                dst[x] = MASK_DARK;
+            } else {
+                dst[x] = MASK_VALID;
             }
         }
     }
-
-    return 0;
 }
 
-float InterpolatedFunction::getX(float y)
+CropFilter::Verdict CropFilter::test(const Image &image, const CropSample &s)
 {
-    int n = data.size();
-    if (y >= yMin && y <= yMax && n >= 2) {
-        for (int i=0; i<n-1; i++) {
-            std::pair<float,float>  &cur = data[i];
-            std::pair<float,float>  &next = data[i+1];
-            if (y >= cur.second && y <= next.second) {
-                float relative = (y - cur.second) / (next.second - cur.second);
-                float x = cur.first + relative*(next.first - cur.first);
-                return x;
-            }
+    if (image.mask.empty()) return Accepted;
+
+    QVector2D   canvas = viewCanvas(renderSize.width(), renderSize.height());
+    cv::Mat     rk = viewRK(s, canvas);
+
+    int     w = image.mask.cols;
+    int     h = image.mask.rows;
+    int     dark = 0;
+    int     nadirs = 0;
+
+    // Sample the footprint on a regular grid of output pixels
+    for (int j=0; j<grid; j++) {
+        for (int i=0; i<grid; i++) {
+            QPointF t((i + 0.5) / grid, (j + 0.5) / grid);
+            QPointF uv = projectPixel(rk, canvas, s.k1, s.k2, t);
+
+            int x = (int)floor(uv.x() * w) % w;
+            int y = qBound(0, (int)floor(uv.y() * h), h-1);
+            if (x < 0) x += w;
+
+            uchar m = image.mask.at<uchar>(y, x);
+            if (m == MASK_DARK) dark ++; else
+            if (m == MASK_NADIR) nadirs ++;
         }
     }
 
-    return 0;
+    int total = grid * grid;
+    if (dark + nadirs > maxInvalid * total) {
+        return (nadirs >= dark ? RejectedNadir : RejectedDark);
+    }
+
+    return Accepted;
 }
 
 
@@ -373,12 +637,17 @@ DatasetSink::DatasetSink(
         ) :
     totalCount(apreset->nImages),
     writtenCount(0),
-    scaleSize(apreset->scaleSize),
-    compression(apreset->compression)
+    scaleSizes(apreset->scaleSizes),
+    compression(apreset->compression),
+    augment(apreset->augment)
 {
     // Open the file & make folder for images
     file = makeNew<H5::H5File>(afilename, H5F_ACC_TRUNC);
-    groupImages = makeNew<H5::Group>(file->createGroup("images"));
+    createGroups("images", groupImages);
+    if (apreset->paired) {
+        // Undistorted twins under the same indices
+        createGroups("undistorted", groupUndistorted);
+    }
 
     // Fill in INFO
     hsize_t         dims[1] = { (hsize_t)apreset->rawData.size() };
@@ -391,6 +660,9 @@ DatasetSink::DatasetSink(
 
     // Alloc data
     labelsData.reserve(2*apreset->nImages);
+    if (augment) {
+        augmentData.reserve(AUGMENT_COLUMNS*apreset->nImages);
+    }
 }
 
 DatasetSink::~DatasetSink()
@@ -405,10 +677,36 @@ DatasetSink::~DatasetSink()
                                 );
         lset.write(labelsData.data(), H5::PredType::NATIVE_FLOAT);
         lset.close();
+
+        // Augmentation parameters, row per image
+        if (augment) {
+            hsize_t         adims[2] = { (hsize_t)writtenCount, AUGMENT_COLUMNS };
+            H5::DataSpace   aspace(2, adims);
+            H5::DataSet     aset = file->createDataSet(
+                                        "augment", H5::PredType::NATIVE_FLOAT, aspace
+                                    );
+            aset.write(augmentData.data(), H5::PredType::NATIVE_FLOAT);
+            aset.close();
+        }
+    }
+
+    for (int i=0; i<groupImages.size(); i++) {
+        groupImages[i]->close();
     }
+    for (int i=0; i<groupUndistorted.size(); i++) {
+        groupUndistorted[i]->close();
+    }
+}
 
-    if (groupImages) {
-        groupImages->close();
+void DatasetSink::createGroups(QString base, QList<QSharedPointer<H5::Group>> &groups)
+{
+    // The largest size keeps the plain name
+    for (int i=0; i<scaleSizes.size(); i++) {
+        QString name = base;
+        if (i > 0) {
+            name += QString("_%1x%2").arg(scaleSizes[i].width()).arg(scaleSizes[i].height());
+        }
+        groups.append(makeNew<H5::Group>(file->createGroup(name.toStdString())));
     }
 }
 
@@ -422,13 +720,12 @@ static cv::Mat toMat(QImage const &img, int format)
 {
    //same as convert mat to qimage, the fifth parameter bytesPerLine()
    //indicate how many bytes per row
-   //If you want to copy the data you need to call clone(), else QImage
-   //cv::Mat will share the buffer
+   //cv::Mat shares the buffer with QImage, which has to outlive it
    return cv::Mat(
                img.height(), img.width(), format,
                const_cast<uchar*>(img.bits()),
                img.bytesPerLine()
-               ).clone();
+               );
 }
 
 
@@ -436,58 +733,104 @@ void DatasetSink::write(QSharedPointer<RenderedImage> frame, CropSample sample)
 {
     if (writtenCount >= totalCount) return ;
 
-    // Rescale & compress
-    cv::Mat     mFrame = toMat(frame->image, CV_8UC3);
-    cv::Mat     mConv, mFinal;
+    store(encode(frame, sample));
+}
 
-    cv::cvtColor(mFrame, mConv, cv::COLOR_BGR2RGB);
+void DatasetSink::encodeSizes(const QImage &image, std::vector<std::vector<uchar>> &data)
+{
+    // Frames come top-down in BGR order, ready for the encoder
+    cv::Mat     mFrame = toMat(image, CV_8UC3);
+    cv::Mat     mLevel = mFrame;
+
+    data.resize(scaleSizes.size());
+    for (int i=0; i<scaleSizes.size(); i++) {
+        int     w = scaleSizes[i].width();
+        int     h = scaleSizes[i].height();
+
+        // Cascade - each size from the previous one when it is larger,
+        // the area filter keeps the result close to a direct resize
+        cv::Mat     mSource = (mLevel.cols >= w && mLevel.rows >= h ? mLevel : mFrame);
+        if (mSource.cols != w || mSource.rows != h) {
+            cv::resize(mSource, mLevel, cv::Size(w, h), 0, 0, cv::INTER_AREA);
+        } else {
+            mLevel = mSource;
+        }
 
-    int         h = mConv.cols;
-    int         w = mConv.rows;
-    if (scaleSize.width() != w || scaleSize.height() != h) {
-        cv::resize(
-                mConv, mFinal,
-                cv::Size(scaleSize.width(), scaleSize.height()),
-                0, 0, cv::INTER_AREA
-            );
-    } else {
-        mFinal = mConv;
+        compress(mLevel, data[i]);
     }
+}
 
-    // Append labels data
-    labelsData.push_back(sample.k1);
-    labelsData.push_back(sample.k2);
-
-    // Compress
-    std::vector<uchar>     data(1024*1024);
+void DatasetSink::compress(const cv::Mat &image, std::vector<uchar> &data)
+{
+    data.resize(1024*1024);
     if (compression == "jpg") {
         std::vector<int>        params;
         params.push_back(cv::IMWRITE_JPEG_QUALITY);
         params.push_back(100);
 
-        cv::imencode(".jpg", mFinal, data, params);
+        cv::imencode(".jpg", image, data, params);
     } else
     if (compression == "png") {
-        cv::imencode(".png", mFinal, data);
+        cv::imencode(".png", image, data);
     }
+}
 
-    // Store the file
-    if (groupImages) {
-        int dataSize = data.size();
-        std::string name = std::to_string(writtenCount);
+QSharedPointer<EncodedImage> DatasetSink::encode(QSharedPointer<RenderedImage> frame, CropSample sample)
+{
+    auto result = makeNew<EncodedImage>();
+    result->sample = sample;
 
-        hsize_t         dims[1] = { (hsize_t)dataSize };
-        H5::DataSpace   dspace(1, dims);
-        H5::DataSet     dset = groupImages->createDataSet(
-                            name.c_str(), H5::PredType::NATIVE_UINT8, dspace
-                            );
-        dset.write(data.data(), H5::PredType::NATIVE_UINT8);
-        dset.close();
+    // Rescale & compress, every scale size
+    encodeSizes(frame->image, result->data);
+    if (!groupUndistorted.isEmpty() && !frame->undistorted.isNull()) {
+        encodeSizes(frame->undistorted, result->undistorted);
+    }
+
+    return result;
+}
+
+void DatasetSink::store(QSharedPointer<EncodedImage> encoded)
+{
+    if (writtenCount >= totalCount || !encoded) return ;
+
+    // Append labels data
+    labelsData.push_back(encoded->sample.k1);
+    labelsData.push_back(encoded->sample.k2);
+
+    // hue, saturation, value, gamma, noise, vignetting, seed
+    if (augment) {
+        const CropSample &s = encoded->sample;
+        const float row[AUGMENT_COLUMNS] = {
+            s.hue, s.saturation, s.value, s.gamma, s.noise, s.vignetting, s.seed
+        };
+        augmentData.insert(augmentData.end(), row, row + AUGMENT_COLUMNS);
+    }
+
+    // Store the file, the twin goes under the same index
+    for (int i=0; i<groupImages.size() && i<(int)encoded->data.size(); i++) {
+        storeImage(groupImages[i].get(), encoded->data[i]);
+    }
+    for (int i=0; i<groupUndistorted.size() && i<(int)encoded->undistorted.size(); i++) {
+        storeImage(groupUndistorted[i].get(), encoded->undistorted[i]);
     }
 
     writtenCount ++;
 }
 
+void DatasetSink::storeImage(H5::Group *group, const std::vector<uchar> &data)
+{
+    int dataSize = data.size();
+    std::string name = std::to_string(writtenCount);
+
+    hsize_t         dims[1] = { (hsize_t)dataSize };
+    H5::DataSpace   dspace(1, dims);
+    H5::DataSet     dset = group->createDataSet(
+                        name.c_str(), H5::PredType::NATIVE_UINT8, dspace
+                        );
+    dset.write(data.data(), H5::PredType::NATIVE_UINT8);
+    dset.close();
+}
+
 
 
 //-----------------------------------------------------------------------------
@@ -501,32 +844,61 @@ PinholeProgram::PinholeProgram(QOpenGLFunctions *func) :
     program(nullptr),
     posVertex(0),
     posTex(0),
+    posRK0(0),
+    posRK1(0),
+    posRK2(0),
+    posCrop(0),
+    posAugment0(0),
+    posAugment1(0),
     posTexture(0),
-    posDistortTexture(0),
     posCanvas(0),
-    posRK(0),
-    posArgs(0),
-    posK(0)
+    posPixelStep(0),
+    posNoiseGrid(0),
+    posTiles(0),
+    posTileTable(0),
+    posTileGrid(0),
+    posTileCount(0)
 {
     heightWise = true;
 }
 
-void PinholeProgram::init()
+void PinholeProgram::init(QStringList defines)
 {
-    // Setup program
+    // Fragment source with the selected paths
+    QByteArray  fragment;
+    for (int i=0; i<defines.size(); i++) {
+        fragment += "#define " + defines[i].toLatin1() + "\n";
+    }
+
+    QFile       file(":/shaders/default.frag");
+    if (file.open(QIODevice::ReadOnly)) {
+        fragment += file.readAll();
+    }
+
+    // Setup program - linked binaries are cached on disk per variant
     program = new QOpenGLShaderProgram();
-    program->addShaderFromSourceFile(QOpenGLShader::Vertex, ":/shaders/default.vert");
-    program->addShaderFromSourceFile(QOpenGLShader::Fragment, ":/shaders/default.frag");
-    program->link();
+    program->addCacheableShaderFromSourceFile(QOpenGLShader::Vertex, ":/shaders/default.vert");
+    program->addCacheableShaderFromSourceCode(QOpenGLShader::Fragment, fragment);
+    if (!program->link()) {
+        printf("Error: Shader variant [%s] failed to link\n", defines.join(" ").toLatin1().constData());
+    }
 
     posVertex = program->attributeLocation("vertex");
     posTex = program->attributeLocation("tex");
+    posRK0 = program->attributeLocation("rk0");
+    posRK1 = program->attributeLocation("rk1");
+    posRK2 = program->attributeLocation("rk2");
+    posCrop = program->attributeLocation("crop");
+    posAugment0 = program->attributeLocation("augment0");
+    posAugment1 = program->attributeLocation("augment1");
     posTexture = program->uniformLocation("texture");
-    posDistortTexture = program->uniformLocation("textureDistort");
-    posRK = program->uniformLocation("rk");
     posCanvas = program->uniformLocation("canvas");
-    posArgs = program->uniformLocation("args");
-    posK = program->uniformLocation("k");
+    posPixelStep = program->uniformLocation("pixelStep");
+    posNoiseGrid = program->uniformLocation("noiseGrid");
+    posTiles = program->uniformLocation("tiles");
+    posTileTable = program->uniformLocation("tileTable");
+    posTileGrid = program->uniformLocation("tileGrid");
+    posTileCount = program->uniformLocation("tileCount");
 }
 
 void PinholeProgram::destroy()
@@ -548,38 +920,31 @@ void PinholeProgram::unbind()
     program->release();
 }
 
-void PinholeProgram::setCanvas(QVector2D value)
-{
-    program->setUniformValue(posCanvas, value);
-}
-
 void PinholeProgram::setTexture(GLint value)
 {
     program->setUniformValue(posTexture, value);
 }
 
-void PinholeProgram::setDistortTexture(GLint value)
-{
-    program->setUniformValue(posDistortTexture, value);
-}
-
-void PinholeProgram::setRK(QMatrix3x3 value)
+void PinholeProgram::setPixelStep(QVector2D value)
 {
-    program->setUniformValue(posRK, value);
+    program->setUniformValue(posPixelStep, value);
 }
 
-void PinholeProgram::setArgs(float gamma, QVector3D hsv)
+void PinholeProgram::setNoiseGrid(QVector2D value)
 {
-    QVector4D   args(hsv, gamma);
-    program->setUniformValue(posArgs, args);
+    program->setUniformValue(posNoiseGrid, value);
 }
 
-void PinholeProgram::setK(QVector4D k)
+void PinholeProgram::setTiles(GLint tiles, GLint table, QVector4D grid, QVector2D count)
 {
-    program->setUniformValue(posK, k);
+    program->setUniformValue(posTiles, tiles);
+    program->setUniformValue(posTileTable, table);
+    program->setUniformValue(posTileGrid, grid);
+    program->setUniformValue(posTileCount, count);
 }
 
-void PinholeProgram::draw()
+// Full screen quad for the post passes
+static void drawQuad(QOpenGLFunctions *f, GLint posVertex, GLint posTex)
 {
     // Vertices
     static const GLfloat vertices[] = {
@@ -615,74 +980,185 @@ void PinholeProgram::draw()
     f->glDisableVertexAttribArray(posTex);
 }
 
-
-void PinholeProgram::prepareView(CropSample s, int width, int height)
+void PinholeProgram::drawCrops(
+            const std::vector<CropSample> &samples,
+            int width, int height, int cols, int rows
+        )
 {
-    // Canvas
-    QVector2D       _canvas(1.0, 1.0);
-    if (heightWise) {
-        if (height > 0) _canvas.setX((float)width / (float)height);
-    } else {
-        if (width > 0) _canvas.setY((float)height / (float)width);
-    }
+    enum { FLOATS = 2 + 2 + 9 + 4 + 4 + 4 };
 
+    QVector2D       _canvas = viewCanvas(width, height, heightWise);
+    int             n = (int)samples.size();
+
+    vertexData.resize((size_t)n * 6 * FLOATS);
+    GLfloat         *v = vertexData.data();
+
+    for (int i=0; i<n; i++) {
+        const CropSample &s = samples[i];
+
+        // Camera Intrinsic, Rotation
+        cv::Mat         RK = viewRK(s, _canvas);
+        const double    *m = (const double*)RK.data;
+
+        // Cell of the atlas, top of the crop on the lower edge
+        int     cx = i % cols;
+        int     cy = i / cols;
+        float   x0 = -1.0 + 2.0 * cx / cols;
+        float   x1 = -1.0 + 2.0 * (cx+1) / cols;
+        float   y0 = -1.0 + 2.0 * cy / rows;
+        float   y1 = -1.0 + 2.0 * (cy+1) / rows;
+
+        const GLfloat corners[6][4] = {
+            { x0, y0, 0.0, 0.0 },
+            { x1, y0, 1.0, 0.0 },
+            { x1, y1, 1.0, 1.0 },
+
+            { x0, y0, 0.0, 0.0 },
+            { x1, y1, 1.0, 1.0 },
+            { x0, y1, 0.0, 1.0 }
+        };
+
+        for (int j=0; j<6; j++) {
+            for (int c=0; c<4; c++) *v++ = corners[j][c];
+
+            // RK columns
+            for (int c=0; c<3; c++) {
+                *v++ = m[0*3 + c];
+                *v++ = m[1*3 + c];
+                *v++ = m[2*3 + c];
+            }
 
-    setCanvas(_canvas);
+            // k1, k2
+            *v++ = s.k1;
+            *v++ = s.k2;
+            *v++ = 0.0;
+            *v++ = 0.0;
+
+            // Augmentation
+            *v++ = s.hue;
+            *v++ = s.saturation;
+            *v++ = s.value;
+            *v++ = s.gamma;
+            *v++ = s.noise;
+            *v++ = s.vignetting;
+            *v++ = s.seed;
+            *v++ = 0.0;
+        }
+    }
 
-    // Focal length
-    double			f = 1;
-    if (s.fov < 180) {
-        f = 1.0 / (2.0 * tan(toRad(s.fov)/2.0));
+    // Bind vertices
+    const GLsizei   stride = FLOATS * sizeof(GLfloat);
+    const GLfloat   *base = vertexData.data();
+    const GLint     attribs[] = { posVertex, posTex, posRK0, posRK1, posRK2, posCrop, posAugment0, posAugment1 };
+    const int       sizes[] = { 2, 2, 3, 3, 3, 4, 4, 4 };
+    const int       count = sizeof(sizes) / sizeof(sizes[0]);
+
+    int offset = 0;
+    for (int a=0; a<count; a++) {
+        if (attribs[a] < 0) {
+            // Compiled out in this variant
+            offset += sizes[a];
+            continue;
+        }
+        f->glVertexAttribPointer(attribs[a], sizes[a], GL_FLOAT, GL_FALSE, stride, base + offset);
+        f->glEnableVertexAttribArray(attribs[a]);
+        offset += sizes[a];
     }
 
-    // Camera Intrinsic, Rotation
-    cv::Mat			K, R;
-    R = RotationMatrix(toRad(s.t), toRad(s.p), toRad(s.r));
-    K = (cv::Mat_<double>(3,3) <<
-            f, 0, _canvas.x() / 2.0,
-            0, f, _canvas.y() / 2.0,
-            0, 0, 1
-        );
+    // Draw
+    f->glDrawArrays(GL_TRIANGLES, 0, n * 6);
 
-    cv::Mat			RK = R * K.inv();
-    RK.convertTo(RK, CV_32F);
+    // cleanup
+    for (int a=0; a<count; a++) {
+        if (attribs[a] >= 0) f->glDisableVertexAttribArray(attribs[a]);
+    }
+}
 
-    QMatrix3x3      _rk((const float*)RK.data);
-    setRK(_rk);
 
+void PinholeProgram::prepareCanvas(int width, int height)
+{
+    QVector2D       _canvas = viewCanvas(width, height, heightWise);
+    program->setUniformValue(posCanvas, _canvas);
 }
 
 cv::Mat PinholeProgram::getInverseRK(CropSample s, int width, int height)
 {
-    // Canvas
-    QVector2D       _canvas(1.0, 1.0);
-    if (heightWise) {
-        if (height > 0) _canvas.setX((float)width / (float)height);
-    } else {
-        if (width > 0) _canvas.setY((float)height / (float)width);
-    }
+    QVector2D       _canvas = viewCanvas(width, height, heightWise);
+    cv::Mat			RK = viewRK(s, _canvas);
+    cv::Mat         RK_INV = RK.inv();
+
+    return RK_INV;
+}
+
+
+
+
+
+//-----------------------------------------------------------------------------
+//
+//  DownsampleProgram
+//
+//-----------------------------------------------------------------------------
+
+DownsampleProgram::DownsampleProgram(QOpenGLFunctions *func) :
+    f(func),
+    program(nullptr),
+    posVertex(0),
+    posTex(0),
+    posSource(0),
+    posSourceSize(0),
+    posTargetSize(0)
+{
+}
+
+void DownsampleProgram::init()
+{
+    // Setup program
+    program = new QOpenGLShaderProgram();
+    program->addShaderFromSourceFile(QOpenGLShader::Vertex, ":/shaders/default.vert");
+    program->addShaderFromSourceFile(QOpenGLShader::Fragment, ":/shaders/downsample.frag");
+    program->link();
 
-    // Focal length
-    double			f = 1;
-    if (s.fov < 180) {
-        f = 1.0 / (2.0 * tan(toRad(s.fov)/2.0));
+    posVertex = program->attributeLocation("vertex");
+    posTex = program->attributeLocation("tex");
+    posSource = program->uniformLocation("source");
+    posSourceSize = program->uniformLocation("sourceSize");
+    posTargetSize = program->uniformLocation("targetSize");
+}
+
+void DownsampleProgram::destroy()
+{
+    if (program) {
+        delete program;
+        program = nullptr;
     }
+}
 
-    // Priprava matic
-    cv::Mat			K, R;
-    R = RotationMatrix(toRad(s.t), toRad(s.p), toRad(s.r));
-    K = (cv::Mat_<double>(3,3) <<
-            f, 0, _canvas.x() / 2.0,
-            0, f, _canvas.y() / 2.0,
-            0, 0, 1
-        );
+void DownsampleProgram::bind()
+{
+    program->bind();
+}
 
-    cv::Mat			RK = R * K.inv();
-    cv::Mat         RK_INV = RK.inv();
+void DownsampleProgram::unbind()
+{
+    program->release();
+}
 
-    return RK_INV;
+void DownsampleProgram::setSource(GLint value)
+{
+    program->setUniformValue(posSource, value);
 }
 
+void DownsampleProgram::setSizes(QSize source, QSize target)
+{
+    program->setUniformValue(posSourceSize, QVector2D(source.width(), source.height()));
+    program->setUniformValue(posTargetSize, QVector2D(target.width(), target.height()));
+}
+
+void DownsampleProgram::draw()
+{
+    drawQuad(f, posVertex, posTex);
+}
 
 
 
@@ -696,19 +1172,67 @@ cv::Mat PinholeProgram::getInverseRK(CropSample s, int width, int height)
 
 CropRenderer::CropRenderer(
         QOffscreenSurface *asurface,
-        QSize asize
+        Preset *apreset,
+        QOpenGLContext *ashareContext,
+        PanoramaUploader *auploader,
+        int apoolSize
         ) :
-    size(asize),
+    size(apreset->renderSize),
+    outSize(apreset->renderSize),
+    noiseSize(apreset->noiseSize()),
+    gpuDownsample(apreset->downsample == "gpu"),
+    directRender(apreset->downsample == "direct"),
+    cubemap(apreset->projection == "cubemap"),
+    cubeSize(apreset->cubeSize),
     context(nullptr),
+    shareContext(ashareContext),
     surface(asurface),
     program(nullptr),
-    pixels(nullptr),
-    texture(nullptr),
-    texDistort(nullptr),
-    isInitialized(false)
+    programTiled(nullptr),
+    downsample(nullptr),
+    colorProcessing(apreset->augment),
+    lensDistortion(true),
+    paired(apreset->paired),
+    batch(qMax(1, apreset->batch)),
+    cols(1),
+    rows(1),
+    rtUndistorted(0),
+    rtTexture(0),
+    rtTextureUndistorted(0),
+    rtScaled(0),
+    rtScaledUndistorted(0),
+    fboScaled(0),
+    readFirst(0),
+    readCount(0),
+    uploader(auploader),
+    ownsUploader(auploader == nullptr),
+    panorama(nullptr),
+    tiling(apreset->tiling),
+    tileCache(qMax(1, apreset->tileCache / qMax(1, apoolSize))),
+    maxTextureSize(0),
+    tiled(nullptr),
+    tiledImage(false),
+    timing(false),
+    isInitialized(false),
+    initFailed(false)
 {
-    // Naalokujeme data
-    pixels = (uchar*)malloc(size.width() * size.height() * 3);
+    for (int i=0; i<READBACK_SLOTS; i++) {
+        readback[i].pbo = 0;
+        readback[i].fence = 0;
+        readback[i].timer = nullptr;
+        readback[i].tiled = false;
+    }
+
+    // Only scaleSize pixels leave the GPU
+    if (gpuDownsample || directRender) {
+        outSize = apreset->scaleSize;
+    }
+
+    // Pinhole only when k is zero for every crop
+    if (apreset->distortion == "none" ||
+        (apreset->k1 == QPair<float,float>(0, 0) && apreset->epsK2 == 0)) {
+        lensDistortion = false;
+    }
 }
 
 CropRenderer::~CropRenderer()
@@ -718,15 +1242,26 @@ CropRenderer::~CropRenderer()
     if (context) {
         context->makeCurrent(surface);
 
-
-        if (texture) {
-            delete texture;
-            texture = nullptr;
+        if (tiled) {
+            delete tiled;
+            tiled = nullptr;
         }
 
-        if (texDistort) {
-            delete texDistort;
-            texDistort = nullptr;
+        // Owns the panorama textures
+        if (uploader && ownsUploader) {
+            delete uploader;
+        }
+        uploader = nullptr;
+        panorama = nullptr;
+
+        auto f = context->extraFunctions();
+        for (int i=0; i<READBACK_SLOTS; i++) {
+            if (readback[i].fence) f->glDeleteSync(readback[i].fence);
+            if (readback[i].pbo) f->glDeleteBuffers(1, &readback[i].pbo);
+            if (readback[i].timer) delete readback[i].timer;
+            readback[i].fence = 0;
+            readback[i].pbo = 0;
+            readback[i].timer = nullptr;
         }
 
         if (program) {
@@ -735,15 +1270,22 @@ CropRenderer::~CropRenderer()
             program = nullptr;
         }
 
+        if (programTiled) {
+            programTiled->destroy();
+            delete programTiled;
+            programTiled = nullptr;
+        }
+
+        if (downsample) {
+            downsample->destroy();
+            delete downsample;
+            downsample = nullptr;
+        }
+
         context->doneCurrent();
         delete context;
         context = nullptr;
     }
-
-    if (pixels) {
-        free(pixels);
-        pixels = nullptr;
-    }
 }
 
 bool CropRenderer::initialize()
@@ -752,220 +1294,508 @@ bool CropRenderer::initialize()
     // zrobime novy kontext
     context = new QOpenGLContext();
     context->setFormat(surface->format());
-    context->create();
-    context->makeCurrent(surface);
+    if (shareContext) {
+        context->setShareContext(shareContext);
+    }
+    if (!context->create() || !context->makeCurrent(surface)) {
+        printf("Error: Failed to create an OpenGL context\n");
+        delete context;
+        context = nullptr;
+        return false;
+    }
     context->extraFunctions()->initializeOpenGLFunctions();
 
     // Loadneme shaders
     program = new PinholeProgram(context->functions());
-    program->init();
+    program->init(shaderDefines(false));
 
     auto f = context->functions();
 
+    // Atlas layout, bounded by the largest target we can allocate
+    QSize   cell = cellSize();
+    GLint   maxTexture = 0, maxRenderbuffer = 0;
+    f->glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTexture);
+    f->glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &maxRenderbuffer);
+    int     maxSize = qMin(maxTexture, maxRenderbuffer);
+    maxTextureSize = maxTexture;
+
+    cols = qBound(1, maxSize / cell.width(), batch);
+    rows = qBound(1, maxSize / cell.height(), (batch + cols - 1) / cols);
+    batch = qMin(batch, cols * rows);
+
+    QSize   rtSize(cell.width() * cols, cell.height() * rows);
+    QSize   outAtlas(outSize.width() * cols, outSize.height() * rows);
+
+    // Paired output needs two draw buffers
+    if (paired) {
+        GLint   maxDrawBuffers = 0;
+        f->glGetIntegerv(GL_MAX_DRAW_BUFFERS, &maxDrawBuffers);
+        if (maxDrawBuffers < 2) {
+            printf("Error: Paired output needs 2 draw buffers, the GPU has %d\n", (int)maxDrawBuffers);
+            return false;
+        }
+    }
+
     // Render Target
-    f->glGenRenderbuffers(1, &rtTarget);
-    f->glBindRenderbuffer(GL_RENDERBUFFER, rtTarget);
-    f->glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA, size.width(), size.height());
-    f->glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    createTarget(rtSize, rtTexture, rtTarget);
+    if (paired) {
+        createTarget(rtSize, rtTextureUndistorted, rtUndistorted);
+    }
 
     // Depth Buffer
     f->glGenRenderbuffers(1, &dsTarget);
     f->glBindRenderbuffer(GL_RENDERBUFFER, dsTarget);
-    f->glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, size.width(), size.height());
+    f->glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, rtSize.width(), rtSize.height());
     f->glBindRenderbuffer(GL_RENDERBUFFER, 0);
 
     // Framebuffer object
     f->glGenFramebuffers(1, &fbo);
     f->glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-    f->glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, rtTarget);
+    if (gpuDownsample) {
+        f->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, rtTexture, 0);
+        if (paired) {
+            f->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, rtTextureUndistorted, 0);
+        }
+    } else {
+        f->glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, rtTarget);
+        if (paired) {
+            f->glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_RENDERBUFFER, rtUndistorted);
+        }
+    }
     f->glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, dsTarget);
     f->glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
+    // Downsample pass
+    if (gpuDownsample) {
+        downsample = new DownsampleProgram(context->functions());
+        downsample->init();
+
+        f->glGenRenderbuffers(1, &rtScaled);
+        f->glBindRenderbuffer(GL_RENDERBUFFER, rtScaled);
+        f->glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, outAtlas.width(), outAtlas.height());
+        f->glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        if (paired) {
+            f->glGenRenderbuffers(1, &rtScaledUndistorted);
+            f->glBindRenderbuffer(GL_RENDERBUFFER, rtScaledUndistorted);
+            f->glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, outAtlas.width(), outAtlas.height());
+            f->glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        }
+
+        f->glGenFramebuffers(1, &fboScaled);
+        f->glBindFramebuffer(GL_FRAMEBUFFER, fboScaled);
+        f->glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, rtScaled);
+        if (paired) {
+            f->glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_RENDERBUFFER, rtScaledUndistorted);
+        }
+        f->glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // Readback buffers, the twins follow the whole distorted atlas
+    GLsizeiptr  frameBytes = (GLsizeiptr)outAtlas.width() * outAtlas.height() * 3;
+    if (paired) {
+        frameBytes *= 2;
+    }
+    for (int i=0; i<READBACK_SLOTS; i++) {
+        f->glGenBuffers(1, &readback[i].pbo);
+        f->glBindBuffer(GL_PIXEL_PACK_BUFFER, readback[i].pbo);
+        f->glBufferData(GL_PIXEL_PACK_BUFFER, frameBytes, nullptr, GL_STREAM_READ);
+    }
+    f->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    // Timestamp queries per readback slot, where the driver has them
+    timing = true;
+    for (int i=0; i<READBACK_SLOTS; i++) {
+        readback[i].timer = new QOpenGLTimeMonitor();
+        readback[i].timer->setSampleCount(TIMER_SAMPLES);
+        if (!readback[i].timer->create()) timing = false;
+    }
+    if (!timing) {
+        warnNoGpuTiming();
+        for (int i=0; i<READBACK_SLOTS; i++) {
+            delete readback[i].timer;
+            readback[i].timer = nullptr;
+        }
+    }
+
+    // Panorama upload thread on a shared context
+    if (!uploader) {
+        uploader = new PanoramaUploader(context, directRender, cubemap, cubeSize);
+        uploader->start();
+    }
+
+    // Filtering across the face edges
+    if (cubemap) {
+        f->glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+    }
+
+    // Tile cache for the oversized ones, faces always fit
+    if (tiling != "never" && !cubemap) {
+        if (context->hasExtension("GL_EXT_texture_array")) {
+            tiled = new TiledPanorama(context->extraFunctions(), tileCache, maxTextureSize, paired);
+        } else {
+            printf("Warning: GL_EXT_texture_array missing, tiling disabled\n");
+        }
+    }
+
     return true;
 }
 
+void CropRenderer::createTarget(QSize rtSize, GLuint &texture, GLuint &renderbuffer)
+{
+    auto f = context->functions();
 
-void CropRenderer::computeDistortTexture(InterpolatedFunction &func, float maxR, bool inverse)
+    if (gpuDownsample) {
+        // Sampled by the downsample pass
+        f->glGenTextures(1, &texture);
+        f->glBindTexture(GL_TEXTURE_2D, texture);
+        f->glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, rtSize.width(), rtSize.height(), 0,
+                        GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        f->glBindTexture(GL_TEXTURE_2D, 0);
+    } else {
+        f->glGenRenderbuffers(1, &renderbuffer);
+        f->glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer);
+        f->glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA, rtSize.width(), rtSize.height());
+        f->glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    }
+}
+
+QStringList CropRenderer::shaderDefines(bool tiledVariant)
 {
-    // Vypocitame maximalny diagonalny radius
-    int n = 256;
+    // Only the work this preset needs
+    QStringList     defines;
+    if (lensDistortion) defines << "DISTORTION_POLY2P";
+    if (colorProcessing) defines << "COLOR_PROCESSING";
+    if (directRender) defines << "FOOTPRINT_SAMPLING";
+    if (tiledVariant) defines << "TILED_PANORAMA";
+    if (cubemap) defines << "CUBEMAP_PANORAMA";
+    if (paired) defines << "PAIRED_OUTPUT";
+
+    return defines;
+}
 
-    if (!texDistort) {
-        texDistort = new QOpenGLTexture(QOpenGLTexture::Target1D);
-        texDistort->setMinMagFilters(QOpenGLTexture::Linear, QOpenGLTexture::Linear);
+PinholeProgram *CropRenderer::tiledProgram()
+{
+    if (!programTiled) {
+        programTiled = new PinholeProgram(context->functions());
+        programTiled->init(shaderDefines(true));
+    }
+    return programTiled;
+}
 
-        texDistort->setSize(n);
-        texDistort->setFormat(QOpenGLTexture::R32F);
-        texDistort->allocateStorage(QOpenGLTexture::Red, QOpenGLTexture::Float32);
+bool CropRenderer::useTiles(QSharedPointer<Image> image)
+{
+    if (!tiled || !image) return false;
+    return TiledPanorama::needed(tiling, maxTextureSize, image->image.size());
+}
+
+void CropRenderer::prefetch(QSharedPointer<Image> image)
+{
+    // Tiles are streamed on demand while rendering
+    if (uploader && image && !useTiles(image)) {
+        uploader->prefetch(image);
     }
+}
 
+void CropRenderer::report(ExportStats &stats)
+{
+    if (tiled) {
+        stats.tileUploads += tiled->uploads;
+        stats.tileMisses += tiled->misses;
+    }
 
-    // Spocitame nove hodnoty
-    std::vector<float>      f;
-    f.resize(n);
-    for (int i=0; i<n; i++) {
-        double y = maxR * ((float)i / (float)(n-1));
-        double r = 0;
-        if (inverse) {
-            r = func.getX(y);
-        } else {
-            r = func.getY(y);
-        }
-        if (y > 0) {
-            f[i] = r/y;
-        } else {
-            f[i] = 1.0;
-        }
+    stats.gpuWait.merge(timeWait);
+    stats.gpuTiles.merge(timeTiles);
+    stats.gpuDraw.merge(timeDraw);
+    stats.gpuDownsample.merge(timeDownsample);
+    stats.gpuReadback.merge(timeReadback);
+
+    if (uploader && ownsUploader) {
+        uploader->report(stats);
+    }
+}
+
+void CropRenderer::collectTiming(Readback &rb)
+{
+    // Never stalls - a result that is not there yet is dropped
+    if (!rb.timer || !rb.timer->isResultAvailable()) return ;
+
+    QVector<GLuint64>   t = rb.timer->waitForIntervals();
+    if (t.size() < TIMER_SAMPLES-1) return ;
+
+    if (rb.tiled) {
+        timeTiles.add(t[1]);
+    } else {
+        timeWait.add(t[0]);
+    }
+    timeDraw.add(t[2]);
+    if (gpuDownsample) {
+        timeDownsample.add(t[3]);
     }
+    timeReadback.add(t[4]);
+}
+
 
-    texDistort->setData(QOpenGLTexture::Red, QOpenGLTexture::Float32, f.data());
+QSize CropRenderer::cellSize()
+{
+    // Direct mode renders straight at scaleSize
+    return (directRender ? outSize : size);
+}
 
+bool CropRenderer::ensureInitialized()
+{
+    if (!isInitialized && !initFailed) {
+        isInitialized = initialize();
+        initFailed = !isInitialized;
+    }
+    return isInitialized;
 }
 
-static float distort(QVector4D k, float r)
+int CropRenderer::batchSize()
 {
-    float r2 = r*r;
-    float r4 = r2*r2;
-    double d = 1.0 + k.x()*r2 + k.y()*r4 + k.z()*(r2*r4) + k.w()*(r4*r4);
-    return d;
+    return (ensureInitialized() ? batch : 0);
 }
 
+bool CropRenderer::canSubmit()
+{
+    return (readCount < READBACK_SLOTS);
+}
 
-static float getMaxR(int width, int height)
+int CropRenderer::pending()
 {
-    float aspect = (float)width / (float)height;
-    float h = 0.5;
-    float w = h * aspect;
-    return sqrt(h*h + w*w);
+    return readCount;
 }
 
-QSharedPointer<RenderedImage> CropRenderer::render(
+bool CropRenderer::submit(
             QSharedPointer<Image> image,
-            CropSample sample
+            const std::vector<CropSample> &samples
         )
 {
 
-    if (!isInitialized) {
-        isInitialized = initialize();
-        // Error ?
-        if (!isInitialized) return nullptr;
-    }
+    if (!ensureInitialized()) return false;
+
+    // Collect first !
+    if (!canSubmit()) return false;
+    if (samples.empty() || (int)samples.size() > batch) return false;
 
     context->makeCurrent(surface);
     auto f = context->extraFunctions();
 
-    //-----------------------------------------------
-    //  View parameters & distortion function
-    QVector4D       k(sample.k1, sample.k2, 0, 0);
+    int     n = (int)samples.size();
+    int     usedRows = (n + cols - 1) / cols;
+    QSize   cell = cellSize();
+    QSize   rtSize(cell.width() * cols, cell.height() * rows);
+    QSize   outAtlas(outSize.width() * cols, outSize.height() * rows);
 
-    float maxR = getMaxR(size.width(), size.height());
-    int n = 256;
-    auto &_dist = dist;
-    _dist.reset();
-    for (int i=0; i<n; i++) {
-        float r = 0.0 + 2.0*maxR*(float)i/(float)(n-1);
-        float d = r * distort(k, r);
-        _dist.add(r, d);
-    }
 
-    computeDistortTexture(_dist, maxR, true);
+    // Timestamps go with the readback slot of this batch
+    Readback    &rb = readback[(readFirst + readCount) % READBACK_SLOTS];
+    if (rb.timer) {
+        rb.timer->reset();
+        rb.timer->recordSample();
+    }
 
 
     //-----------------------------------------------
     //  Rendering
     f->glBindFramebuffer(GL_FRAMEBUFFER, fbo);
 
-    GLenum      bufs = GL_COLOR_ATTACHMENT0;
-    f->glDrawBuffers(1, &bufs); //GL_COLOR_ATTACHMENT0);
+    GLenum      bufs[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    f->glDrawBuffers(paired ? 2 : 1, bufs);
     f->glClearColor(0.5f, 0.0f, 0.0f, 1.0f);
     f->glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    f->glViewport(0,0,size.width(),size.height());
-
-    float       imw = 1.0;
-    float       imh = 1.0;
-
-    // Loadujeme obrazok
-    if (lastImage != image) {
-        lastImage = image;
-
-        if (texture) {
-            delete texture;
-            texture = nullptr;
-        }
-
-        texture = new QOpenGLTexture(QOpenGLTexture::Target2D);
-        texture->setData(image->image, QOpenGLTexture::DontGenerateMipMaps);
-        texture->setMinMagFilters(QOpenGLTexture::Linear, QOpenGLTexture::Linear);
-        texture->setWrapMode(QOpenGLTexture::DirectionS, QOpenGLTexture::Repeat);
-        texture->setWrapMode(QOpenGLTexture::DirectionT, QOpenGLTexture::Repeat);
+    f->glViewport(0,0,rtSize.width(),rtSize.height());
+
+    // Loadujeme obrazok - uploaded asynchronously, usually prefetched.
+    // Held only for this batch, other contexts may share the uploader.
+    tiledImage = useTiles(image);
+    if (tiledImage) {
+        tiled->setImage(image);
+        panorama = nullptr;
+    } else {
+        panorama = uploader->acquire(image);
     }
+    if (rb.timer) rb.timer->recordSample();
 
-    // odlozime si rozlisko
-    if (image) {
-        imw = image->image.width();
-        imh = image->image.height();
+    // Only the tiles under this batch
+    QVector2D   canvas = viewCanvas(size.width(), size.height(), program->HeightWise());
+    if (tiledImage) {
+        tiled->update(samples, canvas);
     }
+    if (rb.timer) rb.timer->recordSample();
 
-    // Kreslime pohlad
-    program->bind();
+    // Kreslime pohlady
+    PinholeProgram  *prog = (tiledImage ? tiledProgram() : program);
+    prog->bind();
         // nahodime texturu
-        if (texture) {
-            texture->bind(0);
-            program->setTexture(0);
-        }
-        if (texDistort) {
-            texDistort->bind(2);
-            program->setDistortTexture(2);
+        if (tiledImage) {
+            tiled->bind(0, 3, 4);
+            prog->setTexture(0);
+            prog->setTiles(3, 4, tiled->grid(), tiled->tileCount());
+        } else if (panorama && panorama->texture) {
+            panorama->texture->bind(0);
+            prog->setTexture(0);
         }
 
-        program->prepareView(sample, size.width(), size.height());
-        program->setArgs(1.0, QVector3D(0.0, 1.0, 1.0));
-        program->setK(k);
-        program->draw();
+        // Geometry always follows renderSize, the cells may be smaller
+        prog->prepareCanvas(size.width(), size.height());
+        prog->setPixelStep(QVector2D(1.0 / cell.width(), 1.0 / cell.height()));
+        prog->setNoiseGrid(QVector2D(noiseSize.width(), noiseSize.height()));
+
+        // Flipped on the GPU - the area filter keeps the orientation
+        prog->drawCrops(samples, size.width(), size.height(), cols, rows);
 
-    program->unbind();
+    prog->unbind();
+    if (rb.timer) rb.timer->recordSample();
 
 
     //----------------------------------------------
-    //  Download result
+    //  Area filter down to scaleSize. The scale is the same for every
+    //  cell, so the filter boxes never cross the cell borders.
+    if (gpuDownsample) {
+        f->glBindFramebuffer(GL_FRAMEBUFFER, fboScaled);
+        f->glViewport(0,0,outAtlas.width(),outAtlas.height());
+
+        downsample->bind();
+            f->glActiveTexture(GL_TEXTURE0);
+            downsample->setSource(0);
+            downsample->setSizes(rtSize, outAtlas);
+
+            // Once per attachment
+            GLuint  sources[2] = { rtTexture, rtTextureUndistorted };
+            for (int k=0; k<(paired ? 2 : 1); k++) {
+                f->glDrawBuffers(1, &bufs[k]);
+                f->glBindTexture(GL_TEXTURE_2D, sources[k]);
+                downsample->draw();
+            }
+            f->glBindTexture(GL_TEXTURE_2D, 0);
+        downsample->unbind();
+    }
+    if (rb.timer) rb.timer->recordSample();
+
+
+    //----------------------------------------------
+    //  Start the readback of the used rows into the next free PBO
+    rb.samples = samples;
+    rb.tiled = tiledImage;
+
     f->glReadBuffer(GL_COLOR_ATTACHMENT0);
-    f->glReadPixels(0,0, size.width(), size.height(),
-                 GLenum(GL_RGB), GLenum(GL_UNSIGNED_BYTE),
-                 pixels
+    f->glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    f->glBindBuffer(GL_PIXEL_PACK_BUFFER, rb.pbo);
+    f->glReadPixels(0,0, outAtlas.width(), outSize.height() * usedRows,
+                 GLenum(GL_BGR), GLenum(GL_UNSIGNED_BYTE),
+                 nullptr
                  );
+    if (paired) {
+        GLsizeiptr  pairOffset = (GLsizeiptr)outAtlas.width() * outAtlas.height() * 3;
+        f->glReadBuffer(GL_COLOR_ATTACHMENT1);
+        f->glReadPixels(0,0, outAtlas.width(), outSize.height() * usedRows,
+                     GLenum(GL_BGR), GLenum(GL_UNSIGNED_BYTE),
+                     (void*)pairOffset
+                     );
+    }
+    f->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (rb.timer) rb.timer->recordSample();
+
+    rb.fence = f->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readCount ++;
+
+    // Upload thread may reuse the texture once this draw is done
+    if (panorama) {
+        uploader->release(panorama);
+    }
 
     // Clean up
     f->glBindRenderbuffer(GL_RENDERBUFFER, 0);
     f->glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-    // Vratime vysledok
-    auto result = makeNew<RenderedImage>();
-    result->image = QImage(size.width(), size.height(), QImage::Format_RGB888);
-    result->RK_inverse = program->getInverseRK(sample, size.width(), size.height());
-
-    // Nakopcime data
-    int h=size.height();
-    for (int y=0; y<h; y++) {
-        uchar *dst = result->image.bits() + y*(size.width() * 3);
-        uchar *src = pixels + (h-1-y)*(size.width() * 3);
+    return true;
+}
 
-        // copy line
-        memcpy(dst, src, size.width() * 3);
-    }
+QList<QSharedPointer<RenderedImage>> CropRenderer::collect()
+{
+    QList<QSharedPointer<RenderedImage>>    result;
+    if (readCount <= 0) return result;
 
-    context->doneCurrent();
+    context->makeCurrent(surface);
+    auto f = context->extraFunctions();
 
-    return result;
-}
+    Readback    &rb = readback[readFirst];
 
+    // Wait for the GPU to finish this batch
+    while (f->glClientWaitSync(rb.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100000000) == GL_TIMEOUT_EXPIRED) {
+    }
+    f->glDeleteSync(rb.fence);
+    rb.fence = 0;
+    collectTiming(rb);
+
+    int         n = (int)rb.samples.size();
+    int         usedRows = (n + cols - 1) / cols;
+    int         w = outSize.width();
+    int         h = outSize.height();
+    int         stride = w * cols * 3;
+    GLsizeiptr  bytes = (GLsizeiptr)stride * h * usedRows;
+    GLsizeiptr  pairOffset = (GLsizeiptr)stride * h * rows;
+
+    f->glBindBuffer(GL_PIXEL_PACK_BUFFER, rb.pbo);
+    const uchar *pixels = (const uchar*)f->glMapBufferRange(
+                            GL_PIXEL_PACK_BUFFER, 0, (paired ? pairOffset + bytes : bytes),
+                            GL_MAP_READ_BIT
+                            );
+    if (pixels) {
+        for (int i=0; i<n; i++) {
+            auto frame = makeNew<RenderedImage>();
+            frame->image = QImage(w, h, QImage::Format_BGR888);
+            frame->RK_inverse = program->getInverseRK(rb.samples[i], size.width(), size.height());
+            frame->sample = rb.samples[i];
+
+            // Nakopcime data z bunky atlasu
+            const uchar *src = pixels + (size_t)(i / cols) * h * stride + (size_t)(i % cols) * w * 3;
+            for (int y=0; y<h; y++) {
+                memcpy(frame->image.scanLine(y), src + (size_t)y * stride, w * 3);
+            }
 
+            // Undistorted twin from the same cell of the second atlas
+            if (paired) {
+                frame->undistorted = QImage(w, h, QImage::Format_BGR888);
+                for (int y=0; y<h; y++) {
+                    memcpy(frame->undistorted.scanLine(y), src + pairOffset + (size_t)y * stride, w * 3);
+                }
+            }
 
+            result.append(frame);
+        }
+        f->glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    f->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
 
+    readFirst = (readFirst + 1) % READBACK_SLOTS;
+    readCount --;
 
+    return result;
+}
 
+QSharedPointer<RenderedImage> CropRenderer::render(
+            QSharedPointer<Image> image,
+            CropSample sample
+        )
+{
+    // Make room for this frame
+    while (!canSubmit()) {
+        collect();
+    }
 
+    std::vector<CropSample>     samples(1, sample);
+    if (!submit(image, samples)) return nullptr;
 
+    auto frames = collect();
+    if (frames.isEmpty()) return nullptr;
+    return frames.first();
+}
 
 
 
@@ -16,6 +16,8 @@
 #include <QOpenGLFunctions>
 #include <QOpenGLExtraFunctions>
 #include <QOpenGLTexture>
+#include <QOpenGLTimeMonitor>
+#include <QOpenGLTimerQuery>
 
 
 namespace Exporter {
@@ -43,14 +45,10 @@ class Image
 public:
     QString         filename;       // 001.jpg
     QImage          image;
+    cv::Mat         mask;           // low-res validity mask (CropFilter)
 };
 
-class RenderedImage
-{
-public:
-    QImage          image;
-    cv::Mat         RK_inverse;
-};
+class CropFilter;
 
 class DatasetImageSource : public PipelineSource<Image>
 {
@@ -61,9 +59,16 @@ protected:
     QString             path;
     QStringList         images;
     int                 index;
+    bool                largeImages;
+
+    QSharedPointer<CropFilter>  filter;
 
 public:
-    DatasetImageSource(QString apath, QStringList aimages);
+    // Large images - decode panoramas of any size, for the tiled and CPU
+    // renderers, otherwise QImageReader keeps a 1 GB limit
+    DatasetImageSource(QString apath, QStringList aimages,
+                       QSharedPointer<CropFilter> afilter = nullptr,
+                       bool alargeImages = false);
 
     // PipelineSource
     virtual QSharedPointer<Image> current();
@@ -116,6 +121,42 @@ public:
 
 };
 
+// Decodes the next image on a worker thread while the current one
+// is being consumed, so the renderer can upload it ahead of time
+class Prefetcher : public PipelineSource<Image>
+{
+protected:
+
+    QMutex              lock;
+    QWaitCondition      cond;
+
+    QSharedPointer<PipelineSource<Image>>       source;
+    QList<QSharedPointer<Image>>                queue;
+    int                                         depth;
+    bool                                        running;
+    bool                                        finished;
+    bool                                        stopping;
+    QThread                                     *worker;
+
+    void produce();
+    void stop();
+    void waitForItem();
+
+public:
+    Prefetcher(QSharedPointer<PipelineSource<Image>> asrc, int adepth = 1);
+    virtual ~Prefetcher();
+
+    // PipelineSource
+    virtual QSharedPointer<Image> current();
+    virtual void reset();
+    virtual void next();
+    virtual bool hasCurrent();
+
+    // Next image after the current one, if already decoded
+    QSharedPointer<Image> upcoming();
+
+};
+
 class CropSample
 {
 public:
@@ -124,6 +165,10 @@ public:
     float           fov;
     float           k1, k2;
 
+    // Photometric augmentation
+    float           hue, saturation, value, gamma;
+    float           noise, vignetting, seed;
+
 public:
     CropSample();
     CropSample(const CropSample &v);
@@ -131,43 +176,136 @@ public:
 
 };
 
-class InterpolatedFunction
+class TimingHistogram
 {
-protected:
+public:
+
+    // Bucket i counts the times in [2^i, 2^(i+1)) microseconds
+    enum { BUCKETS = 24 };
 
-    bool                                    invertible;
-    std::vector<std::pair<float,float>>     data;
-    float                                   xMin, xMax, yMin, yMax;
+    quint64         counts[BUCKETS];
+    quint64         count;
+    double          total;          // milliseconds
 
 public:
-    InterpolatedFunction();
+    TimingHistogram();
+
+    void add(quint64 nanoseconds);
+    void merge(const TimingHistogram &other);
+
+    // Upper bound of the bucket holding the percentile, milliseconds
+    double percentile(double p);
+
+    void print(const char *name);
+};
+
+class ExportStats
+{
+public:
+
+    int             rendered;       // read back, failed batches excluded
+    int             failed;         // submitted, never read back
+    int             rejectedDark;
+    int             rejectedNadir;
+    int             forced;
+
+    // Tiled panoramas
+    int             tileUploads;
+    int             tileMisses;
 
-    void add(float x, float y);
-    void reset();
+    // Ray grids of the CPU renderer
+    int             rayHits;
+    int             rayMisses;
 
-    float getY(float x);
-    float getX(float y);
+    // Batches rendered by each context of the pool
+    QString         renderer;
+    QList<int>      poolBatches;
 
-    std::pair<float,float> xRange();
-    std::pair<float,float> yRange();
+    // GPU time per stage, from timer queries
+    TimingHistogram gpuUpload;          // whole panorama, upload thread
+    TimingHistogram gpuWait;            // waiting for the upload
+    TimingHistogram gpuTiles;           // tile uploads
+    TimingHistogram gpuDraw;
+    TimingHistogram gpuDownsample;
+    TimingHistogram gpuReadback;
+
+public:
+    ExportStats();
+
+    void print();
 };
 
+class CropFilter
+{
+public:
+
+    enum Verdict {
+        Accepted = 0,
+        RejectedDark,
+        RejectedNadir
+    };
 
+protected:
 
+    QSize           renderSize;
+    QSize           maskSize;
+    float           minLuma;
+    float           nadir;
+    float           maxInvalid;
+    int             grid;
+
+public:
+    CropFilter(Preset *apreset);
+
+    // Builds the low-res mask, once per decoded panorama
+    void prepare(Image &image);
+
+    // Tests the crop footprint against the mask
+    Verdict test(const Image &image, const CropSample &s);
+};
+
+class RenderedImage
+{
+public:
+    QImage          image;          // top-down, BGR888
+    QImage          undistorted;    // same view with k1 = k2 = 0, paired output
+    cv::Mat         RK_inverse;
+    CropSample      sample;
+};
+
+class EncodedImage
+{
+public:
+    // Compressed image per scale size, largest first
+    std::vector<std::vector<uchar>>     data;
+    std::vector<std::vector<uchar>>     undistorted;
+    CropSample                          sample;
+};
 
 class DatasetSink
 {
 protected:
 
+    enum { AUGMENT_COLUMNS = 7 };
+
     int                             totalCount;
     int                             writtenCount;
-    QSize                           scaleSize;
+    QList<QSize>                    scaleSizes;
 
+    // Group per scale size - "images", "images_224x224", ...
     QSharedPointer<H5::H5File>      file;
-    QSharedPointer<H5::Group>       groupImages;
+    QList<QSharedPointer<H5::Group>>    groupImages;
+    QList<QSharedPointer<H5::Group>>    groupUndistorted;
     QString                         compression;
 
     std::vector<float>              labelsData;
+    bool                            augment;
+    std::vector<float>              augmentData;
+
+    void createGroups(QString base, QList<QSharedPointer<H5::Group>> &groups);
+    void encodeSizes(const QImage &image, std::vector<std::vector<uchar>> &data);
+    void compress(const cv::Mat &image, std::vector<uchar> &data);
+    void storeImage(H5::Group *group, const std::vector<uchar> &data);
 
 public:
     DatasetSink(const char *afilename, Preset *apreset);
@@ -177,6 +315,12 @@ public:
     void write(QSharedPointer<RenderedImage> frame, CropSample sample);
     bool isComplete();
 
+    // Rescale & compress, safe to call from worker threads
+    QSharedPointer<EncodedImage> encode(QSharedPointer<RenderedImage> frame, CropSample sample);
+
+    // Append to the file, in the order of calls
+    void store(QSharedPointer<EncodedImage> encoded);
+
 };
 
 
@@ -192,74 +336,213 @@ private:
     QOpenGLShaderProgram    *program;
     GLint                   posVertex;
     GLint                   posTex;
+    GLint                   posRK0, posRK1, posRK2;
+    GLint                   posCrop;
+    GLint                   posAugment0, posAugment1;
     GLint                   posTexture;
-    GLint                   posDistortTexture;
     GLint                   posCanvas;
-    GLint                   posRK;
-    GLint                   posArgs;
-    GLint                   posK;
+    GLint                   posPixelStep;
+    GLint                   posNoiseGrid;
+    GLint                   posTiles;
+    GLint                   posTileTable;
+    GLint                   posTileGrid;
+    GLint                   posTileCount;
 
-    void setCanvas(QVector2D value);
-    void setRK(QMatrix3x3 value);
+    std::vector<GLfloat>    vertexData;
 
 public:
     PinholeProgram(QOpenGLFunctions *func);
 
-    void init();
+    // Defines select optional paths of default.frag
+    void init(QStringList defines = QStringList());
     void destroy();
     void bind();
     void unbind();
 
-    void prepareView(CropSample s, int width, int height);
+    void prepareCanvas(int width, int height);
     cv::Mat getInverseRK(CropSample s, int width, int height);
 
     void setTexture(GLint value);
-    void setDistortTexture(GLint value);
-    void setArgs(float gamma, QVector3D hsv);
-    void setK(QVector4D k);
+    void setPixelStep(QVector2D value);
+    void setNoiseGrid(QVector2D value);
+    void setTiles(GLint tiles, GLint table, QVector4D grid, QVector2D count);
 
-    void draw();
+    // One quad per crop, laid out in a cols x rows grid of cells with
+    // the top of each crop on its lowest framebuffer row. Per-crop
+    // RK matrix, k and augmentation travel as vertex attributes.
+    void drawCrops(const std::vector<CropSample> &samples,
+                   int width, int height, int cols, int rows);
 
     inline bool HeightWise() { return heightWise; }
 };
 
 
 
+class DownsampleProgram
+{
+private:
+
+    QOpenGLFunctions        *f;
+
+    // Area filter program
+    QOpenGLShaderProgram    *program;
+    GLint                   posVertex;
+    GLint                   posTex;
+    GLint                   posSource;
+    GLint                   posSourceSize;
+    GLint                   posTargetSize;
+
+public:
+    DownsampleProgram(QOpenGLFunctions *func);
+
+    void init();
+    void destroy();
+    void bind();
+    void unbind();
+
+    void setSource(GLint value);
+    void setSizes(QSize source, QSize target);
+
+    void draw();
+};
+
+
+
+class PanoramaUploader;
+class PanoramaTexture;
+class TiledPanorama;
+
 class CropRenderer
 {
 protected:
 
+    enum { READBACK_SLOTS = 3 };
+
+    // Timestamps around wait, tiles, draw, downsample and readback
+    enum { TIMER_SAMPLES = 6 };
+
+    class Readback
+    {
+    public:
+        GLuint                      pbo;
+        GLsync                      fence;
+        QOpenGLTimeMonitor          *timer;
+        bool                        tiled;
+        std::vector<CropSample>     samples;
+    };
+
     QSize                   size;
+    QSize                   outSize;
+    QSize                   noiseSize;
+    bool                    gpuDownsample;
+    bool                    directRender;
+    bool                    cubemap;
+    int                     cubeSize;
     QOpenGLContext          *context;
+    QOpenGLContext          *shareContext;
     QOffscreenSurface       *surface;
     PinholeProgram          *program;
+    PinholeProgram          *programTiled;
+    DownsampleProgram       *downsample;
+
+    // Shader variant - the color stage runs only with augmentation
+    bool                    colorProcessing;
+    bool                    lensDistortion;
+
+    // Undistorted twin of every crop in a second color attachment
+    bool                    paired;
+
+    // Crops are rendered into a cols x rows atlas of cells
+    int                     batch;
+    int                     cols, rows;
 
     GLuint                  rtTarget, dsTarget;
+    GLuint                  rtUndistorted;
     GLuint                  fbo;
-    uchar                   *pixels;
-
-    QOpenGLTexture          *texture;
-    QOpenGLTexture          *texDistort;
-    QSharedPointer<Image>   lastImage;
 
-    InterpolatedFunction    dist;
+    // Area downsample pass, renderSize -> scaleSize
+    GLuint                  rtTexture;
+    GLuint                  rtTextureUndistorted;
+    GLuint                  rtScaled;
+    GLuint                  rtScaledUndistorted;
+    GLuint                  fboScaled;
+
+    // Ring of PBOs for asynchronous readback
+    Readback                readback[READBACK_SLOTS];
+    int                     readFirst;
+    int                     readCount;
+
+    PanoramaUploader        *uploader;
+    bool                    ownsUploader;
+    PanoramaTexture         *panorama;
+
+    // Panoramas over the texture size limit
+    QString                 tiling;
+    int                     tileCache;
+    int                     maxTextureSize;
+    TiledPanorama           *tiled;
+    bool                    tiledImage;
+
+    // GPU timings, read back with the frames
+    bool                    timing;
+    TimingHistogram         timeWait;
+    TimingHistogram         timeTiles;
+    TimingHistogram         timeDraw;
+    TimingHistogram         timeDownsample;
+    TimingHistogram         timeReadback;
 
 
     bool isInitialized;
+    bool initFailed;
 
 protected:
 
+    // One attempt only, a failed renderer stays failed
+    bool ensureInitialized();
     bool initialize();
+    void createTarget(QSize rtSize, GLuint &texture, GLuint &renderbuffer);
 
-    void computeDistortTexture(InterpolatedFunction &func, float maxR, bool inverse);
+    QSize cellSize();
+    bool useTiles(QSharedPointer<Image> image);
+    void collectTiming(Readback &rb);
+
+    QStringList shaderDefines(bool tiledVariant);
+    PinholeProgram *tiledProgram();
 
 public:
-    CropRenderer(QOffscreenSurface *asurface, QSize asize);
+    // The pool passes its share context and a shared uploader,
+    // a standalone renderer creates its own uploader. Pooled renderers
+    // keep a tile cache each, with their share of the tileCache budget
+    CropRenderer(QOffscreenSurface *asurface, Preset *apreset,
+                 QOpenGLContext *ashareContext = nullptr,
+                 PanoramaUploader *auploader = nullptr,
+                 int apoolSize = 1);
     virtual ~CropRenderer();
 
-    // Rendering
+    // Start uploading the panorama rendered next
+    void prefetch(QSharedPointer<Image> image);
+
+    // Max crops per submit, fixed once initialized, 0 when it failed
+    int batchSize();
+
+    // Tile cache and texture limit, known once initialized
+    bool hasTiles() { return tiled != nullptr; }
+    int textureLimit() { return maxTextureSize; }
+
+    // Rendering - submit() draws a batch of crops of one panorama in a
+    // single pass and starts its readback, collect() returns the frames
+    // of the oldest submitted batch. At most READBACK_SLOTS batches can
+    // be in flight.
+    bool canSubmit();
+    int pending();
+    bool submit(QSharedPointer<Image> image, const std::vector<CropSample> &samples);
+    QList<QSharedPointer<RenderedImage>> collect();
+
+    // Blocking submit & collect of a single crop
     QSharedPointer<RenderedImage> render(QSharedPointer<Image> image, CropSample sample);
 
+    void report(ExportStats &stats);
+
 };
 
 
@@ -0,0 +1,184 @@
+//-----------------------------------------------------------------------------
+//
+//  Football360 Exporter
+//
+//  Author : Igor Janos
+//
+//-----------------------------------------------------------------------------
+#include "pch.h"
+
+
+namespace Exporter {
+
+
+
+//-----------------------------------------------------------------------------
+//
+//  DistortionFanOut
+//
+//-----------------------------------------------------------------------------
+
+DistortionFanOut::DistortionFanOut(Preset *apreset) :
+    renderSize(apreset->renderSize),
+    outSize(apreset->scaleSize),
+    canvas(viewCanvas(apreset->renderSize.width(), apreset->renderSize.height())),
+    margin(1.0),
+    oversample(qMax(1.0f, apreset->fanOversample)),
+    paired(apreset->paired)
+{
+    // Evenly spaced k1 grid, k2 without the noise
+    int n = qMax(1, apreset->fanCount);
+    for (int i=0; i<n; i++) {
+        float u = (n > 1 ? (float)i / (float)(n-1) : 0.0f);
+        float k1 = apreset->fanK1.first + u*(apreset->fanK1.second - apreset->fanK1.first);
+        variants.push_back(QPair<float,float>(k1, k2Fromk1(k1)));
+    }
+
+    // Widest undistorted extent over the output border - the mapping
+    // is radial and monotonic, so the border bounds the whole crop
+    float cx = 0.5f * canvas.x();
+    float cy = 0.5f * canvas.y();
+    for (size_t v=0; v<variants.size(); v++) {
+        for (int j=0; j<=BORDER_STEPS; j++) {
+            float u = (float)j / BORDER_STEPS;
+            QPointF border[4] = {
+                QPointF(u, 0.0), QPointF(u, 1.0), QPointF(0.0, u), QPointF(1.0, u)
+            };
+
+            for (int e=0; e<4; e++) {
+                float px = (border[e].x() - 0.5f) * canvas.x();
+                float py = (border[e].y() - 0.5f) * canvas.y();
+                float rd = sqrt(px*px + py*py);
+                float rate = (rd > 0 ? undistortRadius(rd, variants[v].first, variants[v].second) / rd : 1.0f);
+
+                margin = qMax(margin, qAbs(px * rate) / cx);
+                margin = qMax(margin, qAbs(py * rate) / cy);
+            }
+        }
+    }
+    margin *= 1.01f;
+
+    // Render size of the widened view, remapped at oversample x the output
+    QSize   rs(qRound(renderSize.width() * margin), qRound(renderSize.height() * margin));
+    canvasView = viewCanvas(rs.width(), rs.height());
+    viewSize = QSize(
+                qRound(outSize.width() * margin * oversample),
+                qRound(outSize.height() * margin * oversample)
+                );
+
+    mapXY.resize(variants.size());
+    mapA.resize(variants.size());
+    for (size_t v=0; v<variants.size(); v++) {
+        buildMap(variants[v].first, variants[v].second, mapXY[v], mapA[v]);
+    }
+    if (paired) {
+        buildMap(0.0f, 0.0f, plainXY, plainA);
+    }
+
+    printf("Fan-out : %d variants, margin %.3f, view %dx%d\n",
+           count(), margin, viewSize.width(), viewSize.height()
+           );
+}
+
+void DistortionFanOut::buildMap(float k1, float k2, cv::Mat &mxy, cv::Mat &ma)
+{
+    int     w = outSize.width();
+    int     h = outSize.height();
+    cv::Mat mx(h, w, CV_32FC1);
+    cv::Mat my(h, w, CV_32FC1);
+
+    // Same mapping as distort() in default.frag, into the widened view
+    for (int y=0; y<h; y++) {
+        float   *rx = mx.ptr<float>(y);
+        float   *ry = my.ptr<float>(y);
+        for (int x=0; x<w; x++) {
+            float px = ((x + 0.5f) / w - 0.5f) * canvas.x();
+            float py = ((y + 0.5f) / h - 0.5f) * canvas.y();
+            float rd = sqrt(px*px + py*py);
+            if (rd > 0) {
+                float rate = undistortRadius(rd, k1, k2) / rd;
+                px *= rate;
+                py *= rate;
+            }
+
+            float tx = px / (margin * canvasView.x()) + 0.5f;
+            float ty = py / (margin * canvasView.y()) + 0.5f;
+            rx[x] = tx * viewSize.width() - 0.5f;
+            ry[x] = ty * viewSize.height() - 0.5f;
+        }
+    }
+
+    cv::convertMaps(mx, my, mxy, ma, CV_16SC2);
+}
+
+Preset DistortionFanOut::renderPreset(const Preset &preset)
+{
+    Preset  p = preset;
+    p.renderSize = QSize(qRound(renderSize.width() * margin), qRound(renderSize.height() * margin));
+    p.scaleSize = viewSize;
+    p.scaleSizes = QList<QSize>() << viewSize;
+    p.distortion = "none";
+    p.k1 = QPair<float,float>(0, 0);
+    p.epsK2 = 0;
+    p.paired = false;
+    return p;
+}
+
+CropSample DistortionFanOut::prepare(const CropSample &s)
+{
+    CropSample  result = s;
+    result.fov = 2.0 * atan(margin * tan(toRad(s.fov) / 2.0)) * 180.0 / M_PI;
+    result.k1 = 0;
+    result.k2 = 0;
+    return result;
+}
+
+QList<QSharedPointer<RenderedImage>> DistortionFanOut::expand(QSharedPointer<RenderedImage> frame)
+{
+    QList<QSharedPointer<RenderedImage>>    result;
+    if (!frame) return result;
+
+    const QImage    &img = frame->image;
+    cv::Mat         view(img.height(), img.width(), CV_8UC3, const_cast<uchar*>(img.bits()), img.bytesPerLine());
+
+    // CPU readback comes at the render size
+    if (view.cols != viewSize.width() || view.rows != viewSize.height()) {
+        cv::Mat     scaled;
+        cv::resize(view, scaled, cv::Size(viewSize.width(), viewSize.height()), 0, 0, cv::INTER_AREA);
+        view = scaled;
+    }
+
+    // Original view of the crop
+    CropSample  sample = frame->sample;
+    sample.fov = 2.0 * atan(tan(toRad(sample.fov) / 2.0) / margin) * 180.0 / M_PI;
+
+    QImage      plain;
+    if (paired) {
+        plain = QImage(outSize.width(), outSize.height(), QImage::Format_BGR888);
+        cv::Mat dst(plain.height(), plain.width(), CV_8UC3, plain.bits(), plain.bytesPerLine());
+        cv::remap(view, dst, plainXY, plainA, cv::INTER_LINEAR, cv::BORDER_REPLICATE);
+    }
+
+    for (int v=0; v<count(); v++) {
+        auto variant = makeNew<RenderedImage>();
+        variant->image = QImage(outSize.width(), outSize.height(), QImage::Format_BGR888);
+        variant->undistorted = plain;
+        variant->sample = sample;
+        variant->sample.k1 = variants[v].first;
+        variant->sample.k2 = variants[v].second;
+        variant->RK_inverse = viewRK(variant->sample, canvas).inv();
+
+        // Writes straight into the image
+        QImage  &out = variant->image;
+        cv::Mat dst(out.height(), out.width(), CV_8UC3, out.bits(), out.bytesPerLine());
+        cv::remap(view, dst, mapXY[v], mapA[v], cv::INTER_LINEAR, cv::BORDER_REPLICATE);
+
+        result.append(variant);
+    }
+
+    return result;
+}
+
+
+
+}
@@ -0,0 +1,73 @@
+//-----------------------------------------------------------------------------
+//
+//  Football360 Exporter
+//
+//  Author : Igor Janos
+//
+//-----------------------------------------------------------------------------
+#ifndef FANOUT_H
+#define FANOUT_H
+
+
+namespace Exporter {
+
+//-----------------------------------------------------------------------------
+//
+//  Distortion fan-out
+//
+//  Every view is rendered once through the ideal pinhole, widened by a
+//  margin covering the field of view of the strongest barrel variant.
+//  The distorted variants over a fixed k1 grid are then derived from
+//  that intermediate with a 2D radial remap on the CPU. The remap does
+//  not depend on the view, so its tables are built once.
+//
+//-----------------------------------------------------------------------------
+
+class DistortionFanOut
+{
+public:
+
+    // Output border points checked for the margin, per edge
+    enum { BORDER_STEPS = 64 };
+
+protected:
+
+    QSize                   renderSize;
+    QSize                   outSize;        // scaleSize of the variants
+    QSize                   viewSize;       // remapped intermediate
+    QVector2D               canvas;         // of the variants
+    QVector2D               canvasView;     // of the widened render
+    float                   margin;
+    float                   oversample;
+    bool                    paired;
+
+    // (k1, k2) per variant, fixed point remap tables
+    std::vector<QPair<float,float>>     variants;
+    std::vector<cv::Mat>    mapXY;
+    std::vector<cv::Mat>    mapA;
+
+    // k = 0, the undistorted twin for paired presets
+    cv::Mat                 plainXY;
+    cv::Mat                 plainA;
+
+    void buildMap(float k1, float k2, cv::Mat &mxy, cv::Mat &ma);
+
+public:
+    DistortionFanOut(Preset *apreset);
+
+    int count() { return (int)variants.size(); }
+
+    // Preset of the pinhole render - larger by the margin, no distortion
+    Preset renderPreset(const Preset &preset);
+
+    // Pinhole crop covering every variant of the sample
+    CropSample prepare(const CropSample &s);
+
+    // Distorted variants of one rendered view, safe from worker threads
+    QList<QSharedPointer<RenderedImage>> expand(QSharedPointer<RenderedImage> frame);
+};
+
+
+}
+
+#endif // FANOUT_H
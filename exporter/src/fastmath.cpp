@@ -0,0 +1,38 @@
+//-----------------------------------------------------------------------------
+//
+//  Football360 Exporter
+//
+//  Author : Igor Janos
+//
+//-----------------------------------------------------------------------------
+#include "pch.h"
+
+
+namespace Exporter {
+
+
+
+//-----------------------------------------------------------------------------
+//
+//  Batches
+//
+//-----------------------------------------------------------------------------
+
+void fastAtan2(const float *y, const float *x, float *out, int n)
+{
+    activeKernels().fastAtan2(y, x, out, n);
+}
+
+void fastAsin(const float *x, float *out, int n)
+{
+    activeKernels().fastAsin(x, out, n);
+}
+
+void fastRsqrt(const float *x, float *out, int n)
+{
+    activeKernels().fastRsqrt(x, out, n);
+}
+
+
+
+}
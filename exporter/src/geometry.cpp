@@ -0,0 +1,130 @@
+//-----------------------------------------------------------------------------
+//
+//  Football360 Exporter
+//
+//  Author : Igor Janos
+//
+//-----------------------------------------------------------------------------
+#include "pch.h"
+
+
+namespace Exporter {
+
+
+
+double toRad(double degrees)
+{
+    return degrees * M_PI / 180.0;
+}
+
+cv::Mat RotationMatrix(double rx, double ry, double rz)
+{
+    cv::Mat R_x = (cv::Mat_<double>(3,3) <<
+            1,       0,         0,
+            0,       cos(rx),   -sin(rx),
+            0,       sin(rx),   cos(rx)
+    );
+
+    cv::Mat R_y = (cv::Mat_<double>(3,3) <<
+            cos(ry),    0,      sin(ry),
+            0,          1,      0,
+            -sin(ry),   0,      cos(ry)
+    );
+
+    cv::Mat R_z = (cv::Mat_<double>(3,3) <<
+            cos(rz),    -sin(rz),      0,
+            sin(rz),    cos(rz),       0,
+            0,          0,             1);
+
+    cv::Mat R = R_z * R_y * R_x;
+    return R;
+}
+
+
+QVector2D viewCanvas(int width, int height, bool heightWise)
+{
+    QVector2D       canvas(1.0, 1.0);
+    if (heightWise) {
+        if (height > 0) canvas.setX((float)width / (float)height);
+    } else {
+        if (width > 0) canvas.setY((float)height / (float)width);
+    }
+    return canvas;
+}
+
+cv::Mat viewRK(const CropSample &s, QVector2D canvas)
+{
+    // Focal length
+    double			f = 1;
+    if (s.fov < 180) {
+        f = 1.0 / (2.0 * tan(toRad(s.fov)/2.0));
+    }
+
+    // Camera Intrinsic, Rotation
+    cv::Mat			K, R;
+    R = RotationMatrix(toRad(s.t), toRad(s.p), toRad(s.r));
+    K = (cv::Mat_<double>(3,3) <<
+            f, 0, canvas.x() / 2.0,
+            0, f, canvas.y() / 2.0,
+            0, 0, 1
+        );
+
+    return R * K.inv();
+}
+
+float undistortRadius(float rd, float k1, float k2)
+{
+    // Newton on f(r) = r*(1 + k1*r^2 + k2*r^4) - rd, seeded with
+    // the first order inverse. Converges in a few steps for the
+    // monotonic part of the poly-2p model we sample from.
+    float   rd2 = rd*rd;
+    float   s = 1.0f + k1*rd2 + k2*rd2*rd2;
+    float   r = (s > 0.1f ? rd / s : rd);
+
+    for (int i=0; i<4; i++) {
+        float r2 = r*r;
+        float r4 = r2*r2;
+        float fr = r*(1.0f + k1*r2 + k2*r4) - rd;
+        float df = 1.0f + 3.0f*k1*r2 + 5.0f*k2*r4;
+        if (df <= 1e-6f) break;
+        r -= fr / df;
+    }
+
+    return r;
+}
+
+QPointF projectPixel(const cv::Mat &rk, QVector2D canvas, float k1, float k2, QPointF t)
+{
+    // Undistorted position on the view plane
+    double  cx = 0.5 * canvas.x();
+    double  cy = 0.5 * canvas.y();
+    double  px = t.x() * canvas.x() - cx;
+    double  py = t.y() * canvas.y() - cy;
+    double  rd = sqrt(px*px + py*py);
+    if (rd > 0) {
+        double rate = undistortRadius(rd, k1, k2) / rd;
+        px *= rate;
+        py *= rate;
+    }
+
+    // Ray in panorama space
+    const double *m = (const double*)rk.data;
+    double  x = px + cx;
+    double  y = py + cy;
+    double  rx = m[0]*x + m[1]*y + m[2];
+    double  ry = m[3]*x + m[4]*y + m[5];
+    double  rz = m[6]*x + m[7]*y + m[8];
+
+    // Equirectangular mapping
+    double  theta = atan2(rx, rz);
+    double  phi = atan2(ry, sqrt(rx*rx + rz*rz));
+
+    return QPointF(
+            (theta / M_PI + 1.0) / 2.0,
+            (phi + M_PI_2) / M_PI
+        );
+}
+
+
+
+}
@@ -0,0 +1,43 @@
+//-----------------------------------------------------------------------------
+//
+//  Football360 Exporter
+//
+//  Author : Igor Janos
+//
+//-----------------------------------------------------------------------------
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+
+namespace Exporter {
+
+//-----------------------------------------------------------------------------
+//
+//  Pinhole camera geometry
+//
+//  CPU mirror of the math in default.frag, shared by the PinholeProgram
+//  and by everything that needs to know where a crop lands on the
+//  panorama without rendering it.
+//
+//-----------------------------------------------------------------------------
+
+double toRad(double degrees);
+cv::Mat RotationMatrix(double rx, double ry, double rz);
+
+// Canvas extents of the view plane for the given render size
+QVector2D viewCanvas(int width, int height, bool heightWise = true);
+
+// R * K^-1 for the given crop, 3x3 CV_64F
+cv::Mat viewRK(const CropSample &s, QVector2D canvas);
+
+// Inverse of rd = ru * (1 + k1*ru^2 + k2*ru^4)
+float undistortRadius(float rd, float k1, float k2);
+
+// Maps the texture coordinate of an output pixel (0..1, top-down)
+// to the equirectangular panorama coordinate (0..1, not wrapped)
+QPointF projectPixel(const cv::Mat &rk, QVector2D canvas, float k1, float k2, QPointF t);
+
+
+}
+
+#endif // GEOMETRY_H
@@ -124,6 +124,14 @@ float readFloat(const QJsonObject &json, QString name)
     return 0;
 }
 
+bool readBool(const QJsonObject &json, QString name)
+{
+    if (json.contains(name) && json[name].isBool()) {
+        return json[name].toBool();
+    }
+    return false;
+}
+
 
 //-----------------------------------------------------------------------------
 //  Preset
@@ -132,13 +140,45 @@ float readFloat(const QJsonObject &json, QString name)
 Preset::Preset() :
     renderSize(1920, 1080),
     scaleSize(448, 448),
+    downsample("cpu"),
+    batch(1),
+    pool(1),
+    tiling("auto"),
+    tileCache(512),
     compression("png"),
     nImages(1000),
+    sampler("uniform"),
     rangePan(-40, 40),
     rangeTilt(-25, -2),
     rangeRoll(-2, 2),
-    rangeFOV(10, 50)
+    rangeFOV(10, 50),
+    distortion("poly-2p"),
+    k1(0, 0),
+    epsK2(0),
+    paired(false),
+    fanOut(false),
+    fanK1(0, 0),
+    fanCount(1),
+    fanOversample(2),
+    rayGrids(0),
+    rayStep(0),
+    layout("blocked"),
+    projection("equirect"),
+    cubeSize(0),
+    rejection(false),
+    minLuma(0.05),
+    nadir(60),
+    maxInvalid(0.25),
+    retries(20),
+    augment(false),
+    augHue(0, 0),
+    augSaturation(1, 1),
+    augValue(1, 1),
+    augGamma(1, 1),
+    augNoise(0, 0),
+    augVignetting(0, 0)
 {
+    scaleSizes.append(scaleSize);
 }
 
 bool Preset::read(QString filename)
@@ -160,9 +200,41 @@ bool Preset::read(QString filename)
 bool Preset::read(const QJsonObject &json)
 {
     renderSize = toSize(readListInt(json, "renderSize"));
-    scaleSize = toSize(readListInt(json, "scaleSize"));
+
+    // Single [w, h] or a list of them, all made from the same render
+    scaleSizes.clear();
+    if (json.contains("scaleSize") && json["scaleSize"].isArray()) {
+        auto items = json["scaleSize"].toArray();
+        if (!items.isEmpty() && items[0].isArray()) {
+            for (int i=0; i<items.size(); i++) {
+                auto s = items[i].toArray();
+                scaleSizes.append(QSize(s[0].toInt(), s[1].toInt()));
+            }
+        } else {
+            scaleSizes.append(toSize(readListInt(json, "scaleSize")));
+        }
+    }
+    std::sort(scaleSizes.begin(), scaleSizes.end(), [](const QSize &a, const QSize &b) {
+        int aa = a.width() * a.height();
+        int ab = b.width() * b.height();
+        return (aa != ab ? aa > ab : a.width() > b.width());
+    });
+
+    // Each size is one dataset group, stored once
+    int nSizes = scaleSizes.size();
+    scaleSizes.erase(std::unique(scaleSizes.begin(), scaleSizes.end()), scaleSizes.end());
+    if (scaleSizes.size() < nSizes) {
+        printf("Warning: Duplicate scaleSize entries ignored\n");
+    }
+    scaleSize = scaleSizes.value(0);
     compression = readString(json, "compression");
+    if (json.contains("downsample")) downsample = readString(json, "downsample");
+    if (json.contains("batch")) batch = readInt(json, "batch");
+    if (json.contains("pool")) pool = readInt(json, "pool");
+    if (json.contains("tiling")) tiling = readString(json, "tiling");
+    if (json.contains("tileCache")) tileCache = readInt(json, "tileCache");
     nImages = readInt(json, "nImages");
+    if (json.contains("sampler")) sampler = readString(json, "sampler");
 
     // View
     if (json.contains("view") && json["view"].isObject()) {
@@ -180,10 +252,58 @@ bool Preset::read(const QJsonObject &json)
         k1 = toPair(readListFloat(dp, "k1"));
         epsK2 = readFloat(dp, "epsK2");
     }
+    if (json.contains("paired")) paired = readBool(json, "paired");
+
+    // Fan-out
+    if (json.contains("fanOut") && json["fanOut"].isObject()) {
+        auto fo = json["fanOut"].toObject();
+        fanOut = true;
+        fanK1 = toPair(readListFloat(fo, "k1"));
+        if (fo.contains("count")) fanCount = readInt(fo, "count");
+        if (fo.contains("oversample")) fanOversample = readFloat(fo, "oversample");
+    }
+
+    // Ray grid cache
+    if (json.contains("rayCache") && json["rayCache"].isObject()) {
+        auto rc = json["rayCache"].toObject();
+        if (rc.contains("grids")) rayGrids = readInt(rc, "grids");
+        if (rc.contains("k")) rayStep = readFloat(rc, "k");
+    }
+    if (json.contains("layout")) layout = readString(json, "layout");
+    if (json.contains("projection")) projection = readString(json, "projection");
+    if (json.contains("cubeSize")) cubeSize = readInt(json, "cubeSize");
+
+    // Rejection
+    if (json.contains("rejection") && json["rejection"].isObject()) {
+        auto rj = json["rejection"].toObject();
+        rejection = true;
+        if (rj.contains("minLuma")) minLuma = readFloat(rj, "minLuma");
+        if (rj.contains("nadir")) nadir = readFloat(rj, "nadir");
+        if (rj.contains("maxInvalid")) maxInvalid = readFloat(rj, "maxInvalid");
+        if (rj.contains("retries")) retries = readInt(rj, "retries");
+    }
+
+    // Augmentation
+    if (json.contains("augment") && json["augment"].isObject()) {
+        auto ag = json["augment"].toObject();
+        augment = true;
+        if (ag.contains("hue")) augHue = toPair(readListFloat(ag, "hue"));
+        if (ag.contains("saturation")) augSaturation = toPair(readListFloat(ag, "saturation"));
+        if (ag.contains("value")) augValue = toPair(readListFloat(ag, "value"));
+        if (ag.contains("gamma")) augGamma = toPair(readListFloat(ag, "gamma"));
+        if (ag.contains("noise")) augNoise = toPair(readListFloat(ag, "noise"));
+        if (ag.contains("vignetting")) augVignetting = toPair(readListFloat(ag, "vignetting"));
+    }
 
     return true;
 }
 
+QSize Preset::noiseSize() const
+{
+    if (!scaleSize.isValid() || scaleSize.isEmpty()) return renderSize;
+    return scaleSize.boundedTo(renderSize);
+}
+
 
 
 
@@ -210,6 +330,20 @@ float normal(float mean, float stddev)
     return d(generator);
 }
 
+uint32_t uniformBits()
+{
+    std::uniform_int_distribution<uint32_t> d;
+    return d(generator);
+}
+
+void warnNoGpuTiming()
+{
+    static QAtomicInt   reported(0);
+    if (reported.testAndSetRelaxed(0, 1)) {
+        printf("Warning: GPU timing unavailable, the context has no timer queries\n");
+    }
+}
+
 
 
 
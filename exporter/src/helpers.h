@@ -18,6 +18,10 @@ QPair<QStringList, QStringList> loadSplitJson(QString filename);
 
 float uniform(QPair<float,float> args);
 float normal(float mean, float stddev);
+uint32_t uniformBits();         // all 32 bits, for seeds
+
+// Once per process - every context of the pool finds the same driver
+void warnNoGpuTiming();
 
 
 inline int min(int a, int b) { return (a < b ? a : b); }
@@ -35,11 +39,18 @@ public:
     QByteArray              rawData;
 
     QSize                   renderSize;
-    QSize                   scaleSize;
+    QSize                   scaleSize;      // largest of scaleSizes, rendered
+    QList<QSize>            scaleSizes;     // stored, largest first
+    QString                 downsample;
+    int                     batch;
+    int                     pool;
+    QString                 tiling;
+    int                     tileCache;
     QString                 compression;
     int                     nImages;
 
     // View
+    QString                 sampler;
     QPair<float, float>     rangePan;
     QPair<float, float>     rangeTilt;
     QPair<float, float>     rangeRoll;
@@ -49,12 +60,45 @@ public:
     QString                 distortion;
     QPair<float, float>     k1;
     float                   epsK2;
+    bool                    paired;         // undistorted twin of every crop
+
+    // Distortion fan-out - k1 grid remapped from one pinhole render
+    bool                    fanOut;
+    QPair<float, float>     fanK1;
+    int                     fanCount;
+    float                   fanOversample;
+
+    // Ray grids of the CPU renderer (0 - off), k1 / k2 bins (0 - exact)
+    int                     rayGrids;
+    float                   rayStep;
+    QString                 layout;         // panorama in memory, linear / blocked
+    QString                 projection;     // equirect / cubemap
+    int                     cubeSize;       // face size, 0 - auto
+
+    // Rejection of unusable crops
+    bool                    rejection;
+    float                   minLuma;
+    float                   nadir;
+    float                   maxInvalid;
+    int                     retries;
+
+    // Photometric augmentation, applied in the render shader
+    bool                    augment;
+    QPair<float, float>     augHue;
+    QPair<float, float>     augSaturation;
+    QPair<float, float>     augValue;
+    QPair<float, float>     augGamma;
+    QPair<float, float>     augNoise;
+    QPair<float, float>     augVignetting;
 
 public:
     Preset();
 
     bool read(QString filename);
     bool read(const QJsonObject &json);
+
+    // Output pixel grid the sensor noise is drawn on, in every downsample mode
+    QSize noiseSize() const;
 };
 
 
@@ -0,0 +1,288 @@
+//-----------------------------------------------------------------------------
+//
+//  Football360 Exporter
+//
+//  Author : Igor Janos
+//
+//-----------------------------------------------------------------------------
+#include "pch.h"
+
+
+namespace Exporter {
+
+
+
+//-----------------------------------------------------------------------------
+//
+//  RenderBackend
+//
+//-----------------------------------------------------------------------------
+
+QSharedPointer<RenderBackend> RenderBackend::create(QString renderer, Preset *apreset, int poolSize)
+{
+    if (renderer == "cpu") {
+        return makeNew<CpuRenderer>(apreset);
+    }
+    if (renderer != "gl") {
+        printf("Warning: Unknown renderer \"%s\", using gl\n", renderer.toLatin1().constData());
+    }
+    return makeNew<RendererPool>(apreset, poolSize);
+}
+
+
+//-----------------------------------------------------------------------------
+//
+//  RendererPool
+//
+//-----------------------------------------------------------------------------
+
+RendererPool::RendererPool(Preset *apreset, int acount) :
+    count(qMax(1, acount)),
+    shareContext(nullptr),
+    uploader(nullptr),
+    pendingBatches(0),
+    ready(0),
+    alive(0),
+    batch(INT_MAX),
+    stopping(false),
+    tiling(apreset->tiling),
+    tiles(false),
+    maxTextureSize(INT_MAX)
+{
+    QSurfaceFormat  format = QSurfaceFormat::defaultFormat();
+
+    // Root of the share group, never made current
+    shareContext = new QOpenGLContext();
+    shareContext->setFormat(format);
+    shareContext->create();
+
+    uploader = new PanoramaUploader(shareContext, apreset->downsample == "direct",
+                                    apreset->projection == "cubemap", apreset->cubeSize
+                                    );
+    uploader->start();
+
+    batchesDone.assign(count, 0);
+
+    // Surfaces have to be created on the GUI thread, the contexts
+    // are created by the renderers on their own threads
+    for (int i=0; i<count; i++) {
+        auto surface = new QOffscreenSurface();
+        surface->setFormat(format);
+        surface->create();
+        surfaces.append(surface);
+
+        auto worker = new Worker();
+        worker->pool = this;
+        worker->index = i;
+        // The contexts render different panoramas at the same time, so the
+        // tile caches stay private and split the budget
+        worker->renderer = new CropRenderer(surface, apreset, shareContext, uploader, count);
+        workers.append(worker);
+    }
+
+    for (int i=0; i<count; i++) {
+        workers[i]->start();
+    }
+}
+
+RendererPool::~RendererPool()
+{
+    {
+        QMutexLocker    l(&lock);
+        stopping = true;
+        cond.wakeAll();
+    }
+
+    // Renderers are destroyed on their threads
+    for (int i=0; i<workers.size(); i++) {
+        workers[i]->wait();
+        delete workers[i];
+    }
+    workers.clear();
+
+    if (uploader) {
+        delete uploader;
+        uploader = nullptr;
+    }
+
+    if (shareContext) {
+        delete shareContext;
+        shareContext = nullptr;
+    }
+
+    for (int i=0; i<surfaces.size(); i++) {
+        delete surfaces[i];
+    }
+    surfaces.clear();
+}
+
+void RendererPool::Worker::run()
+{
+    pool->work(this);
+}
+
+void RendererPool::work(Worker *worker)
+{
+    CropRenderer    *renderer = worker->renderer;
+
+    // Creates the context on this thread
+    int b = renderer->batchSize();
+    if (b <= 0) {
+        printf("Error: Renderer %d failed to initialize, stopping it\n", worker->index);
+        {
+            QMutexLocker    l(&lock);
+            worker->renderer = nullptr;
+            ready ++;
+            cond.wakeAll();
+        }
+        delete renderer;
+        return ;
+    }
+
+    {
+        QMutexLocker    l(&lock);
+        batch = qMin(batch, b);
+        tiles = tiles || renderer->hasTiles();
+        maxTextureSize = qMin(maxTextureSize, renderer->textureLimit());
+        ready ++;
+        alive ++;
+        cond.wakeAll();
+    }
+
+    while (true) {
+        Job     job;
+        bool    haveJob = false;
+
+        {
+            QMutexLocker    l(&lock);
+            while (!stopping && jobs.isEmpty() && renderer->pending() == 0) {
+                cond.wait(&lock);
+            }
+
+            if (!jobs.isEmpty()) {
+                job = jobs.takeFirst();
+                haveJob = true;
+                cond.wakeAll();
+            } else
+            if (stopping && renderer->pending() == 0) {
+                break;
+            }
+        }
+
+        // Render, or flush the readbacks while there is nothing to do
+        QList<QSharedPointer<RenderedImage>>    frames;
+        int     done = 0;
+
+        if (!haveJob || !renderer->canSubmit()) {
+            frames = renderer->collect();
+            done ++;
+        }
+        bool    failed = false;
+        if (haveJob && !renderer->submit(job.image, job.samples)) {
+            printf("Error: Renderer %d failed to submit a batch\n", worker->index);
+            failed = true;
+            done ++;
+        }
+
+        {
+            QMutexLocker    l(&lock);
+            results.append(frames);
+            pendingBatches -= done;
+            if (haveJob && !failed) {
+                batchesDone[worker->index] ++;
+            }
+            cond.wakeAll();
+        }
+    }
+
+    // report() reads the renderers under the lock
+    {
+        QMutexLocker    l(&lock);
+        worker->renderer = nullptr;
+    }
+    delete renderer;
+}
+
+int RendererPool::batchSize()
+{
+    QMutexLocker    l(&lock);
+    while (ready < count) {
+        cond.wait(&lock);
+    }
+    return (alive > 0 ? qMax(1, batch) : 0);
+}
+
+void RendererPool::prefetch(QSharedPointer<Image> image)
+{
+    if (!uploader || !image) return ;
+
+    // Same test as CropRenderer::prefetch, once the renderers know
+    // their texture limit
+    {
+        QMutexLocker    l(&lock);
+        while (ready < count) {
+            cond.wait(&lock);
+        }
+        if (tiles && TiledPanorama::needed(tiling, maxTextureSize, image->image.size())) return ;
+    }
+
+    uploader->prefetch(image);
+}
+
+void RendererPool::submit(QSharedPointer<Image> image, const std::vector<CropSample> &samples)
+{
+    Job     job;
+    job.image = image;
+    job.samples = samples;
+
+    QMutexLocker    l(&lock);
+    while (jobs.size() >= qMax(1, alive)) {
+        cond.wait(&lock);
+    }
+
+    jobs.append(job);
+    pendingBatches ++;
+    cond.wakeAll();
+}
+
+QList<QSharedPointer<RenderedImage>> RendererPool::collect(bool wait)
+{
+    QMutexLocker    l(&lock);
+    while (wait && results.isEmpty() && pendingBatches > 0) {
+        cond.wait(&lock);
+    }
+
+    QList<QSharedPointer<RenderedImage>>    frames;
+    frames.swap(results);
+    return frames;
+}
+
+void RendererPool::finish()
+{
+    QMutexLocker    l(&lock);
+    while (pendingBatches > 0) {
+        cond.wait(&lock);
+    }
+}
+
+void RendererPool::report(ExportStats &stats)
+{
+    QMutexLocker    l(&lock);
+
+    stats.renderer = "gl";
+    stats.poolBatches.clear();
+    for (int i=0; i<count; i++) {
+        stats.poolBatches.append(batchesDone[i]);
+        if (workers[i]->renderer) {
+            workers[i]->renderer->report(stats);
+        }
+    }
+
+    if (uploader) {
+        uploader->report(stats);
+    }
+}
+
+
+
+}
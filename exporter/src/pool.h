@@ -0,0 +1,137 @@
+//-----------------------------------------------------------------------------
+//
+//  Football360 Exporter
+//
+//  Author : Igor Janos
+//
+//-----------------------------------------------------------------------------
+#ifndef POOL_H
+#define POOL_H
+
+
+namespace Exporter {
+
+//-----------------------------------------------------------------------------
+//
+//  Render backend
+//
+//  What the export loop renders with - a pool of GL contexts, or the
+//  CPU renderer on nodes without a GPU.
+//
+//-----------------------------------------------------------------------------
+
+class RenderBackend
+{
+public:
+    virtual ~RenderBackend() {}
+
+    // Batches rendered at the same time
+    virtual int contexts() = 0;
+
+    // Max crops per submit
+    virtual int batchSize() = 0;
+
+    // Start uploading the panorama rendered next
+    virtual void prefetch(QSharedPointer<Image> image) = 0;
+
+    // Queue a batch of crops of one panorama
+    virtual void submit(QSharedPointer<Image> image, const std::vector<CropSample> &samples) = 0;
+
+    // Frames rendered so far, optionally waiting for at least one
+    virtual QList<QSharedPointer<RenderedImage>> collect(bool wait = false) = 0;
+
+    // Wait until all submitted batches are done
+    virtual void finish() = 0;
+
+    virtual void report(ExportStats &stats) = 0;
+
+    // "gl" or "cpu", must be called on the GUI thread
+    static QSharedPointer<RenderBackend> create(QString renderer, Preset *apreset, int poolSize);
+};
+
+
+//-----------------------------------------------------------------------------
+//
+//  Renderer pool
+//
+//  N CropRenderers, each with its own context and offscreen surface on
+//  its own thread. All contexts share one group with the panorama
+//  uploader, so a panorama is uploaded once for the whole pool. Batches
+//  go to whichever renderer is free, frames come back in the order
+//  they are read back.
+//
+//-----------------------------------------------------------------------------
+
+class RendererPool : public RenderBackend
+{
+protected:
+
+    class Job
+    {
+    public:
+        QSharedPointer<Image>       image;
+        std::vector<CropSample>     samples;
+    };
+
+    class Worker : public QThread
+    {
+    public:
+        RendererPool        *pool;
+        int                 index;
+        CropRenderer        *renderer;
+
+    protected:
+        virtual void run();
+    };
+
+    int                     count;
+    QOpenGLContext          *shareContext;
+    PanoramaUploader        *uploader;
+    QList<QOffscreenSurface*>   surfaces;
+    QList<Worker*>          workers;
+
+    QMutex                  lock;
+    QWaitCondition          cond;
+    QList<Job>              jobs;
+    QList<QSharedPointer<RenderedImage>>    results;
+    int                     pendingBatches;
+    int                     ready;
+    int                     alive;          // renderers that initialized
+    int                     batch;
+    bool                    stopping;
+
+    // Tiled panoramas are streamed by the renderers, never prefetched
+    QString                 tiling;
+    bool                    tiles;
+    int                     maxTextureSize;
+    std::vector<int>        batchesDone;
+
+    void work(Worker *worker);
+
+public:
+    // Must be constructed on the GUI thread
+    RendererPool(Preset *apreset, int acount);
+    virtual ~RendererPool();
+
+    virtual int contexts() { return count; }
+
+    // Smallest batch of the renderers that initialized, 0 when none did
+    virtual int batchSize();
+
+    // Only the panoramas the renderers upload whole
+    virtual void prefetch(QSharedPointer<Image> image);
+
+    // Blocks while every renderer has a batch waiting
+    virtual void submit(QSharedPointer<Image> image, const std::vector<CropSample> &samples);
+
+    // Frames in the order they are read back
+    virtual QList<QSharedPointer<RenderedImage>> collect(bool wait = false);
+
+    virtual void finish();
+    virtual void report(ExportStats &stats);
+};
+
+
+}
+
+#endif // POOL_H
@@ -0,0 +1,211 @@
+//-----------------------------------------------------------------------------
+//
+//  Football360 Exporter
+//
+//  Author : Igor Janos
+//
+//-----------------------------------------------------------------------------
+#include "pch.h"
+
+
+namespace Exporter {
+
+
+
+float k2Fromk1(float k1)
+{
+    return 0.019*k1 + 0.805*k1*k1;
+}
+
+static float lerp(QPair<float,float> range, float u)
+{
+    return range.first + u*(range.second - range.first);
+}
+
+
+//-----------------------------------------------------------------------------
+//
+//  CropSampler
+//
+//-----------------------------------------------------------------------------
+
+CropSampler::CropSampler(Preset *apreset) :
+    preset(apreset)
+{
+}
+
+CropSampler::~CropSampler()
+{
+}
+
+void CropSampler::finish(CropSample &sample, const float u[5])
+{
+    // view
+    sample.p = lerp(preset->rangePan, u[0]);
+    sample.t = lerp(preset->rangeTilt, u[1]);
+    sample.r = lerp(preset->rangeRoll, u[2]);
+    sample.fov = lerp(preset->rangeFOV, u[3]);
+
+    // distortion
+    if (preset->distortion == "none") {
+        sample.k1 = sample.k2 = 0.0;
+    } else {
+        sample.k1 = lerp(preset->k1, u[4]);
+        sample.k2 = k2Fromk1(sample.k1) + normal(0.0, preset->epsK2);
+    }
+
+    // photometric augmentation, independent of the view sequence
+    if (preset->augment) {
+        sample.hue = uniform(preset->augHue);
+        sample.saturation = uniform(preset->augSaturation);
+        sample.value = uniform(preset->augValue);
+        sample.gamma = uniform(preset->augGamma);
+        sample.noise = uniform(preset->augNoise);
+        sample.vignetting = uniform(preset->augVignetting);
+        sample.seed = uniform(QPair<float,float>(0.0, 1.0));
+    }
+}
+
+QSharedPointer<CropSampler> CropSampler::create(Preset *apreset)
+{
+    if (apreset->sampler == "sobol") {
+        return makeNew<SobolSampler>(apreset);
+    }
+
+    return makeNew<UniformSampler>(apreset);
+}
+
+
+//-----------------------------------------------------------------------------
+//
+//  UniformSampler
+//
+//-----------------------------------------------------------------------------
+
+UniformSampler::UniformSampler(Preset *apreset) :
+    CropSampler(apreset)
+{
+}
+
+void UniformSampler::sample(CropSample &sample)
+{
+    float   u[5];
+    for (int i=0; i<5; i++) {
+        u[i] = uniform(QPair<float,float>(0.0, 1.0));
+    }
+
+    finish(sample, u);
+}
+
+
+//-----------------------------------------------------------------------------
+//
+//  SobolSampler
+//
+//-----------------------------------------------------------------------------
+
+/*
+    Primitive polynomials and initial direction numbers for dimensions
+    2..5 (Joe & Kuo, new-joe-kuo-6.21201). The first dimension is the
+    van der Corput sequence.
+
+        s = degree, a = polynomial coefficients, m = initial numbers
+*/
+
+static const struct {
+    int         s;
+    uint32_t    a;
+    uint32_t    m[3];
+} sobolInit[SobolSampler::DIMENSIONS-1] = {
+    { 1, 0, { 1 } },
+    { 2, 1, { 1, 3 } },
+    { 3, 1, { 1, 3, 1 } },
+    { 3, 2, { 1, 1, 1 } }
+};
+
+
+static uint32_t reverseBits(uint32_t x)
+{
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+// Owen scrambling through a hash based permutation (Burley 2020)
+static uint32_t nestedUniformScramble(uint32_t x, uint32_t seed)
+{
+    x = reverseBits(x);
+
+    // Laine-Karras permutation
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+
+    return reverseBits(x);
+}
+
+
+SobolSampler::SobolSampler(Preset *apreset) :
+    CropSampler(apreset),
+    index(0)
+{
+    // van der Corput
+    for (int i=0; i<BITS; i++) {
+        directions[0][i] = 1u << (BITS-1-i);
+    }
+
+    // Remaining dimensions
+    for (int d=1; d<DIMENSIONS; d++) {
+        int         s = sobolInit[d-1].s;
+        uint32_t    a = sobolInit[d-1].a;
+        uint32_t    *v = directions[d];
+
+        for (int i=0; i<s; i++) {
+            v[i] = sobolInit[d-1].m[i] << (BITS-1-i);
+        }
+        for (int i=s; i<BITS; i++) {
+            v[i] = v[i-s] ^ (v[i-s] >> s);
+            for (int k=1; k<s; k++) {
+                v[i] ^= ((a >> (s-1-k)) & 1u) * v[i-k];
+            }
+        }
+    }
+
+    // Random scrambling per run
+    for (int d=0; d<DIMENSIONS+1; d++) {
+        seeds[d] = uniformBits();
+    }
+}
+
+void SobolSampler::point(uint32_t i, float u[DIMENSIONS])
+{
+    // Shuffled index keeps any prefix of the sequence well distributed
+    i = nestedUniformScramble(i, seeds[DIMENSIONS]);
+
+    for (int d=0; d<DIMENSIONS; d++) {
+        uint32_t x = 0;
+        uint32_t bits = i;
+        for (int b=0; bits != 0; b++, bits >>= 1) {
+            if (bits & 1u) x ^= directions[d][b];
+        }
+
+        x = nestedUniformScramble(x, seeds[d]);
+        u[d] = (float)((x >> 8) * (1.0 / 16777216.0));
+    }
+}
+
+void SobolSampler::sample(CropSample &sample)
+{
+    float   u[DIMENSIONS];
+    point(index++, u);
+
+    finish(sample, u);
+}
+
+
+
+}
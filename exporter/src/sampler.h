@@ -0,0 +1,78 @@
+//-----------------------------------------------------------------------------
+//
+//  Football360 Exporter
+//
+//  Author : Igor Janos
+//
+//-----------------------------------------------------------------------------
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+
+namespace Exporter {
+
+//-----------------------------------------------------------------------------
+//
+//  Crop samplers
+//
+//  Draw view (pan, tilt, roll, fov) and distortion (k1) parameters from
+//  the preset ranges. k2 always follows k2Fromk1 with gaussian noise.
+//
+//-----------------------------------------------------------------------------
+
+class CropSampler
+{
+protected:
+
+    Preset          *preset;
+
+    void finish(CropSample &sample, const float u[5]);
+
+public:
+    CropSampler(Preset *apreset);
+    virtual ~CropSampler();
+
+    virtual void sample(CropSample &sample) = 0;
+
+    static QSharedPointer<CropSampler> create(Preset *apreset);
+};
+
+
+// Independent uniform draws
+class UniformSampler : public CropSampler
+{
+public:
+    UniformSampler(Preset *apreset);
+
+    virtual void sample(CropSample &sample);
+};
+
+
+// Owen-scrambled Sobol sequence over the 5D parameter space
+class SobolSampler : public CropSampler
+{
+public:
+
+    enum { DIMENSIONS = 5, BITS = 32 };
+
+protected:
+
+    uint32_t        directions[DIMENSIONS][BITS];
+    uint32_t        seeds[DIMENSIONS+1];
+    uint32_t        index;
+
+    void point(uint32_t i, float u[DIMENSIONS]);
+
+public:
+    SobolSampler(Preset *apreset);
+
+    virtual void sample(CropSample &sample);
+};
+
+
+float k2Fromk1(float k1);
+
+
+}
+
+#endif // SAMPLER_H
@@ -0,0 +1,500 @@
+//-----------------------------------------------------------------------------
+//
+//  Football360 Exporter
+//
+//  Author : Igor Janos
+//
+//-----------------------------------------------------------------------------
+#include "pch.h"
+
+#include <random>
+
+
+using namespace Exporter;
+
+
+//-----------------------------------------------------------------------------
+//
+//  Helpers
+//
+//-----------------------------------------------------------------------------
+
+static const int    BENCH_RUNS = 5;
+static const int    MATH_VALUES = 1 << 16;      // fits L2, measures the math
+static const int    MATH_ROUNDS = 64;
+static const int    SWEEP_VALUES = 1 << 22;     // for the maximum error
+
+// Best of BENCH_RUNS, nanoseconds per item
+template<class F> static double timeIt(F fn, double items)
+{
+    double  best = 0;
+    for (int r=0; r<BENCH_RUNS; r++) {
+        QElapsedTimer   timer;
+        timer.start();
+        fn();
+        double ns = (double)timer.nsecsElapsed() / items;
+        if (r == 0 || ns < best) best = ns;
+    }
+    return best;
+}
+
+// Keeps the results alive
+static volatile float   benchSink;
+
+static void consume(const std::vector<float> &v)
+{
+    float s = 0;
+    for (size_t i=0; i<v.size(); i += 97) s += v[i];
+    benchSink = s;
+}
+
+// libm, then every kernel set of this CPU with its maximum error
+template<class L, class F, class E>
+static void benchMathFunction(const char *name, const char *unit, bool pixels,
+                              L libm, F fast, E error, double items)
+{
+    double  base = timeIt(libm, items);
+    printf("   %-8s libm     %6.2f ns\n", name, base);
+
+    for (const KernelSet *k : kernelSets()) {
+        double  ns = timeIt([&]() { fast(k); }, items);
+        double  err = error(k);
+        printf("            %-8s %6.2f ns   x%5.1f   max error %.1e %s",
+               k->isa, ns, (ns > 0 ? base / ns : 0.0), err, unit
+               );
+        if (pixels) {
+            printf(" (%.4f px @ 16K)", err * FASTMATH_PX_PER_RAD);
+        }
+        printf("\n");
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+//
+//  Fast math against libm
+//
+//-----------------------------------------------------------------------------
+
+static void benchMath()
+{
+    std::mt19937                            rng(360);
+    std::uniform_real_distribution<float>   unit(-1.0f, 1.0f);
+    std::uniform_real_distribution<float>   expo(-4.0f, 4.0f);
+
+    std::vector<float>  x(MATH_VALUES), y(MATH_VALUES), a(MATH_VALUES), q(MATH_VALUES);
+    std::vector<float>  out(MATH_VALUES);
+    for (int i=0; i<MATH_VALUES; i++) {
+        x[i] = unit(rng);
+        y[i] = unit(rng);
+        a[i] = unit(rng);
+        q[i] = powf(10.0f, expo(rng));
+    }
+    double  items = (double)MATH_VALUES * MATH_ROUNDS;
+
+    printf("Fast math, active kernels %s\n", kernelISA());
+
+    // atan2 over the full circle, radius does not matter
+    {
+        std::vector<float>  sy(SWEEP_VALUES), sx(SWEEP_VALUES), so(SWEEP_VALUES);
+        for (int i=0; i<SWEEP_VALUES; i++) {
+            double t = -M_PI + 2.0 * M_PI * i / SWEEP_VALUES;
+            sy[i] = (float)sin(t);
+            sx[i] = (float)cos(t);
+        }
+
+        benchMathFunction("atan2", "rad", true,
+            [&]() {
+                for (int r=0; r<MATH_ROUNDS; r++)
+                for (int i=0; i<MATH_VALUES; i++) out[i] = atan2f(y[i], x[i]);
+                consume(out);
+            },
+            [&](const KernelSet *k) {
+                for (int r=0; r<MATH_ROUNDS; r++) k->fastAtan2(y.data(), x.data(), out.data(), MATH_VALUES);
+                consume(out);
+            },
+            [&](const KernelSet *k) {
+                k->fastAtan2(sy.data(), sx.data(), so.data(), SWEEP_VALUES);
+                double err = 0;
+                for (int i=0; i<SWEEP_VALUES; i++) {
+                    err = qMax(err, fabs(so[i] - atan2((double)sy[i], (double)sx[i])));
+                }
+                return err;
+            },
+            items);
+    }
+
+    // asin
+    {
+        std::vector<float>  sa(SWEEP_VALUES + 1), so(SWEEP_VALUES + 1);
+        for (int i=0; i<=SWEEP_VALUES; i++) {
+            sa[i] = (float)(-1.0 + 2.0 * i / SWEEP_VALUES);
+        }
+
+        benchMathFunction("asin", "rad", true,
+            [&]() {
+                for (int r=0; r<MATH_ROUNDS; r++)
+                for (int i=0; i<MATH_VALUES; i++) out[i] = asinf(a[i]);
+                consume(out);
+            },
+            [&](const KernelSet *k) {
+                for (int r=0; r<MATH_ROUNDS; r++) k->fastAsin(a.data(), out.data(), MATH_VALUES);
+                consume(out);
+            },
+            [&](const KernelSet *k) {
+                k->fastAsin(sa.data(), so.data(), SWEEP_VALUES + 1);
+                double err = 0;
+                for (int i=0; i<=SWEEP_VALUES; i++) {
+                    err = qMax(err, fabs(so[i] - asin((double)sa[i])));
+                }
+                return err;
+            },
+            items);
+    }
+
+    // rsqrt, relative error
+    {
+        std::vector<float>  sq(SWEEP_VALUES), so(SWEEP_VALUES);
+        for (int i=0; i<SWEEP_VALUES; i++) {
+            sq[i] = (float)pow(10.0, -4.0 + 8.0 * i / SWEEP_VALUES);
+        }
+
+        benchMathFunction("rsqrt", "rel", false,
+            [&]() {
+                for (int r=0; r<MATH_ROUNDS; r++)
+                for (int i=0; i<MATH_VALUES; i++) out[i] = 1.0f / sqrtf(q[i]);
+                consume(out);
+            },
+            [&](const KernelSet *k) {
+                for (int r=0; r<MATH_ROUNDS; r++) k->fastRsqrt(q.data(), out.data(), MATH_VALUES);
+                consume(out);
+            },
+            [&](const KernelSet *k) {
+                k->fastRsqrt(sq.data(), so.data(), SWEEP_VALUES);
+                double err = 0;
+                for (int i=0; i<SWEEP_VALUES; i++) {
+                    double ref = 1.0 / sqrt((double)sq[i]);
+                    err = qMax(err, fabs(so[i] - ref) / ref);
+                }
+                return err;
+            },
+            items);
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+//
+//  Row kernels of every set, single thread
+//
+//-----------------------------------------------------------------------------
+
+// Noise - no caching effects from flat areas
+static void noisePanorama(int width, int height, std::vector<uint32_t> &pixels, KernelPanorama &pano)
+{
+    std::mt19937    rng(360);
+    pixels.resize((size_t)width * height);
+    for (size_t i=0; i<pixels.size(); i++) pixels[i] = rng();
+
+    pano.pixels = pixels.data();
+    pano.width = width;
+    pano.height = height;
+    pano.stride = width;
+    pano.layout = KernelPanorama::LAYOUT_LINEAR;
+}
+
+static KernelView benchView(const CropSample &s, QSize size, bool distortion)
+{
+    QVector2D   canvas = viewCanvas(size.width(), size.height());
+    cv::Mat     RK = viewRK(s, canvas);
+
+    KernelView  view;
+    for (int i=0; i<9; i++) view.rk[i] = (float)((const double*)RK.data)[i];
+    view.canvasX = canvas.x();
+    view.canvasY = canvas.y();
+    view.k1 = s.k1;
+    view.k2 = s.k2;
+    view.distortion = distortion;
+    view.width = size.width();
+    view.height = size.height();
+    view.grid = nullptr;
+    return view;
+}
+
+// Nanoseconds per output pixel of a whole view
+static double timeView(const KernelSet &k, const KernelView &view, const KernelPanorama &pano)
+{
+    std::vector<float>  rgb(3 * view.width);
+    float   *r = rgb.data();
+    float   *g = r + view.width;
+    float   *b = g + view.width;
+
+    return timeIt([&]() {
+        for (int y=0; y<view.height; y++) k.reprojectRow(view, pano, y, r, g, b);
+        consume(rgb);
+    }, (double)view.width * view.height);
+}
+
+static double timeView(const KernelView &view, const KernelPanorama &pano)
+{
+    return timeView(activeKernels(), view, pano);
+}
+
+static void benchKernel()
+{
+    std::vector<uint32_t>   pixels;
+    KernelPanorama          pano;
+    noisePanorama(8192, 4096, pixels, pano);
+
+    CropSample  s;
+    s.p = 20;
+    s.t = -12;
+    s.r = 1;
+    s.fov = 40;
+    s.k1 = -0.3f;
+    s.k2 = k2Fromk1(s.k1);
+    s.hue = 0.05f;
+    s.saturation = 1.2f;
+    s.value = 0.9f;
+    s.gamma = 1.1f;
+    s.noise = 0.02f;
+    s.vignetting = 0.3f;
+    s.seed = 0.77f;
+
+    KernelView  view = benchView(s, QSize(1920, 1080), true);
+
+    std::vector<float>  grid((size_t)2 * view.width * view.height);
+    for (int y=0; y<view.height; y++) {
+        float *gx = grid.data() + (size_t)y * 2 * view.width;
+        distortRow(view, y, gx, gx + view.width);
+    }
+    KernelView  gridView = view;
+    gridView.grid = grid.data();
+
+    KernelColor color;
+    color.hue = s.hue;
+    color.saturation = s.saturation;
+    color.value = s.value;
+    color.gamma = s.gamma;
+    color.noise = s.noise;
+    color.vignetting = s.vignetting;
+    color.seed = s.seed;
+    color.canvasX = view.canvasX;
+    color.canvasY = view.canvasY;
+    color.width = view.width;
+    color.height = view.height;
+    color.noiseWidth = view.width;
+    color.noiseHeight = view.height;
+
+    // The stages after the reprojection on one rendered row, 3x area filter
+    std::vector<float>  row(3 * view.width), work(3 * view.width), acc(view.width);
+    for (int i=0; i<3 * view.width; i++) row[i] = (float)((i * 7919) % 1000) / 999.0f;
+    std::vector<uint8_t>    packed(3 * view.width);
+    AreaTaps    taps;
+    taps.build(view.width, view.width / 3);
+    int     rows = view.height;
+    double  items = (double)view.width * rows;
+
+    printf("\n");
+    printf("Row kernels %dx%d, one thread, ns/px\n", view.width, view.height);
+    printf("   set      reproject  grid    color   accumulate  pack\n");
+
+    for (const KernelSet *k : kernelSets()) {
+        int     w = view.width;
+        double  reproject = timeView(*k, view, pano);
+        double  cached = timeView(*k, gridView, pano);
+        double  tc = timeIt([&]() {
+            for (int y=0; y<rows; y++) {
+                std::copy(row.begin(), row.end(), work.begin());
+                k->colorRow(color, y, work.data(), work.data() + w, work.data() + 2*w);
+            }
+            consume(work);
+        }, items);
+        double  ta = timeIt([&]() {
+            int ow = w / 3;
+            std::fill(acc.begin(), acc.end(), 0.0f);
+            for (int y=0; y<rows; y++) {
+                k->accumulateRow(taps, 1.0f / rows, row.data(), row.data() + w, row.data() + 2*w,
+                                 acc.data(), acc.data() + ow, acc.data() + 2*ow);
+            }
+            consume(acc);
+        }, items);
+        double  tp = timeIt([&]() {
+            for (int y=0; y<rows; y++) {
+                k->packRow(row.data(), row.data() + w, row.data() + 2*w, w, packed.data());
+            }
+            benchSink = packed[w - 1];
+        }, items);
+
+        printf("   %-8s %6.2f    %6.2f  %6.2f   %6.2f     %6.2f\n",
+               k->isa, reproject, cached, tc, ta, tp
+               );
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+//
+//  Panorama layout - linear rows against blocks
+//
+//-----------------------------------------------------------------------------
+
+static void benchLayout()
+{
+    // Full size panorama, the row stride is what hurts
+    std::vector<uint32_t>   pixels;
+    KernelPanorama          linear;
+    noisePanorama(16384, 8192, pixels, linear);
+
+    std::vector<uint32_t>   blocks(blockedSize(linear.width, linear.height));
+    int     rows = (linear.height + KernelPanorama::BLOCK - 1) / KernelPanorama::BLOCK;
+    for (int row=0; row<rows; row++) {
+        blockRow(linear, blocks.data(), row);
+    }
+    KernelPanorama  blocked = blockedPanorama(blocks.data(), linear.width, linear.height);
+
+    printf("\n");
+    printf("Panorama layout %dx%d, %dx%d blocks, one thread, %s\n",
+           linear.width, linear.height, (int)KernelPanorama::BLOCK, (int)KernelPanorama::BLOCK, kernelISA()
+           );
+    printf("   roll   fov     linear    blocked\n");
+
+    const float rolls[] = { 0, 30, 90 };
+    const float fovs[] = { 10, 40, 90 };
+    for (float roll : rolls) {
+        for (float fov : fovs) {
+            CropSample  s;
+            s.p = 10;
+            s.t = -20;
+            s.r = roll;
+            s.fov = fov;
+            s.k1 = s.k2 = 0;
+
+            KernelView  view = benchView(s, QSize(1920, 1080), false);
+            double  tl = timeView(view, linear);
+            double  tb = timeView(view, blocked);
+            printf("   %4.0f   %3.0f   %5.2f ns   %5.2f ns   x%.2f\n",
+                   roll, fov, tl, tb, (tb > 0 ? tl / tb : 0.0)
+                   );
+        }
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+//
+//  Cube map against the equirectangular panorama
+//
+//-----------------------------------------------------------------------------
+
+// Smooth in the ray direction, so the poles carry no aliasing and the
+// difference is the resampling alone
+static void spherePanorama(int width, int height, std::vector<uint32_t> &pixels, KernelPanorama &pano)
+{
+    pixels.resize((size_t)width * height);
+
+    auto channel = [](double a) {
+        return (uint32_t)qBound(0, (int)lround(127.5 + 127.0 * a), 255);
+    };
+
+    for (int y=0; y<height; y++) {
+        double  lat = M_PI * (0.5 - (y + 0.5) / height);
+        for (int x=0; x<width; x++) {
+            double  lon = 2.0 * M_PI * ((x + 0.5) / width - 0.5);
+            double  dx = cos(lat) * sin(lon);
+            double  dy = sin(lat);
+            double  dz = cos(lat) * cos(lon);
+
+            pixels[(size_t)y * width + x] = 0xff000000u |
+                    (channel(sin(60.0 * dx) * cos(45.0 * dy)) << 16) |
+                    (channel(sin(35.0 * dz + 20.0 * dy)) << 8) |
+                    channel(cos(80.0 * dy) * sin(25.0 * dx));
+        }
+    }
+
+    pano.pixels = pixels.data();
+    pano.width = width;
+    pano.height = height;
+    pano.stride = width;
+    pano.layout = KernelPanorama::LAYOUT_LINEAR;
+}
+
+static void benchCubemap()
+{
+    std::vector<uint32_t>   pixels;
+    KernelPanorama          equirect;
+    spherePanorama(8192, 4096, pixels, equirect);
+
+    CubeMap         cube;
+    QElapsedTimer   timer;
+    timer.start();
+    cube.build(equirect, CubeMap::autoSize(equirect.width));
+    double  buildMs = (double)timer.nsecsElapsed() / 1e6;
+    KernelPanorama  faces = cube.panorama();
+
+    printf("\n");
+    printf("Cube map %d px faces from %dx%d, built in %.0f ms on %d threads\n",
+           cube.size, equirect.width, equirect.height, buildMs, QThread::idealThreadCount()
+           );
+    printf("    pan  tilt  roll  fov    equirect      cube            error mean / p99 / max\n");
+
+    class Case
+    {
+    public:
+        float   p, t, r, fov;
+    };
+
+    const Case  cases[] = {
+        { 10, -20,  0, 10 }, { 10, -20,  0, 40 }, { 10, -20, 30, 90 },
+        { 45,  45,  0, 40 }, {  0, -80,  0, 40 }, {  0, -80, 10, 90 }
+    };
+
+    for (const Case &c : cases) {
+        CropSample  s;
+        s.p = c.p;
+        s.t = c.t;
+        s.r = c.r;
+        s.fov = c.fov;
+        s.k1 = s.k2 = 0;
+
+        KernelView  view = benchView(s, QSize(1920, 1080), false);
+        double  te = timeView(view, equirect);
+        double  tc = timeView(view, faces);
+
+        // Difference in 8 bit levels
+        std::vector<float>  a(3 * view.width), b(3 * view.width);
+        std::vector<float>  diff;
+        diff.reserve((size_t)3 * view.width * view.height);
+        for (int y=0; y<view.height; y++) {
+            reprojectRow(view, equirect, y, a.data(), a.data() + view.width, a.data() + 2 * view.width);
+            reprojectRow(view, faces, y, b.data(), b.data() + view.width, b.data() + 2 * view.width);
+            for (size_t i=0; i<a.size(); i++) diff.push_back(255.0f * fabsf(a[i] - b[i]));
+        }
+
+        double  mean = 0;
+        for (float d : diff) mean += d;
+        mean /= diff.size();
+
+        size_t  p99 = diff.size() * 99 / 100;
+        std::nth_element(diff.begin(), diff.begin() + p99, diff.end());
+        float   e99 = diff[p99];
+        float   emax = *std::max_element(diff.begin() + p99, diff.end());
+
+        printf("   %4.0f  %4.0f  %4.0f  %3.0f   %5.2f ns   %5.2f ns   x%.2f   %5.3f / %4.2f / %4.2f\n",
+               c.p, c.t, c.r, c.fov, te, tc, (tc > 0 ? te / tc : 0.0), mean, e99, emax
+               );
+    }
+}
+
+
+bool taskBench(Args &args)
+{
+    Q_UNUSED(args);
+
+    benchMath();
+    benchKernel();
+    benchLayout();
+    benchCubemap();
+
+    return true;
+}
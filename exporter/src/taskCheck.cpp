@@ -0,0 +1,161 @@
+//-----------------------------------------------------------------------------
+//
+//  Football360 Exporter
+//
+//  Author : Igor Janos
+//
+//-----------------------------------------------------------------------------
+#include "pch.h"
+
+#include <random>
+
+
+using namespace Exporter;
+
+
+//-----------------------------------------------------------------------------
+//
+//  Tiled against untiled paired rendering
+//
+//-----------------------------------------------------------------------------
+
+static const int    CHECK_CROPS = 32;
+static const int    CHECK_LEVELS = 8;           // larger differences count as wrong
+static const double CHECK_WRONG = 1.0e-4;       // allowed fraction of wrong pixels
+
+// Noise - every texel differs from the 4096 px overview
+static QSharedPointer<Image> noiseImage(int width, int height, int seed)
+{
+    auto            image = makeNew<Image>();
+    std::mt19937    rng(seed);
+
+    image->filename = "noise";
+    image->image = QImage(width, height, QImage::Format_RGB32);
+    for (int y=0; y<height; y++) {
+        uint32_t *line = (uint32_t*)image->image.scanLine(y);
+        for (int x=0; x<width; x++) line[x] = rng() | 0xff000000;
+    }
+
+    return image;
+}
+
+class FrameDiff
+{
+public:
+    int             maxDiff;
+    qint64          wrong;
+    qint64          total;
+
+    FrameDiff() : maxDiff(0), wrong(0), total(0) {}
+
+    void add(const QImage &a, const QImage &b)
+    {
+        if (a.size() != b.size() || a.isNull()) {
+            wrong += qMax(1LL, (qint64)a.width() * a.height() * 3);
+            return ;
+        }
+
+        for (int y=0; y<a.height(); y++) {
+            const uchar *la = a.constScanLine(y);
+            const uchar *lb = b.constScanLine(y);
+            for (int x=0; x<a.width() * 3; x++) {
+                int d = abs((int)la[x] - (int)lb[x]);
+                maxDiff = qMax(maxDiff, d);
+                if (d > CHECK_LEVELS) wrong ++;
+            }
+        }
+        total += (qint64)a.width() * a.height() * 3;
+    }
+
+    bool passed()
+    {
+        return (total > 0 && wrong <= CHECK_WRONG * total);
+    }
+
+    void print(const char *name)
+    {
+        printf("   %-12s max diff %3d, over %d levels %.4f%% - %s\n",
+               name, maxDiff, CHECK_LEVELS,
+               (total > 0 ? 100.0 * wrong / total : 100.0),
+               (passed() ? "ok" : "FAILED")
+               );
+    }
+};
+
+
+bool taskCheck(Args &args)
+{
+    // Preset of the export, forced to a paired, tileable render
+    Preset      preset;
+    if (!args.inputPresetJson.empty()) {
+        preset.read(args.inputPresetJson.c_str());
+    }
+    preset.paired = true;
+    preset.fanOut = false;
+    preset.projection = "equirect";
+    preset.distortion = "poly-2p";
+    preset.k1 = QPair<float, float>(-0.45, 0.12);
+    preset.batch = 1;
+
+    // Footprint sampling has no counterpart on the tiles
+    if (preset.downsample == "direct") {
+        preset.downsample = "cpu";
+    }
+
+    Preset      tiledPreset = preset;
+    Preset      plainPreset = preset;
+    tiledPreset.tiling = "always";
+    plainPreset.tiling = "never";
+
+    QOffscreenSurface   surface;
+    surface.setFormat(QSurfaceFormat::defaultFormat());
+    surface.create();
+
+    CropRenderer    tiled(&surface, &tiledPreset);
+    CropRenderer    plain(&surface, &plainPreset);
+    if (tiled.batchSize() <= 0 || plain.batchSize() <= 0) {
+        printf("Error: Renderers failed to initialize\n");
+        return false;
+    }
+    if (!tiled.hasTiles()) {
+        printf("Error: No tile cache, nothing to check\n");
+        return false;
+    }
+
+    // Alternating panoramas - a new one drops the resident tiles, so
+    // each crop gets only the tiles marked for it
+    QSharedPointer<Image>   images[2] = {
+        noiseImage(8192, 4096, 360), noiseImage(8192, 4096, 361)
+    };
+    auto        sampler = CropSampler::create(&preset);
+    FrameDiff   distorted, undistorted;
+
+    // k1 swept over the barrel and pincushion ends of the presets
+    for (int i=0; i<CHECK_CROPS; i++) {
+        auto        image = images[i % 2];
+        CropSample  s;
+        sampler->sample(s);
+        s.k1 = preset.k1.first + (preset.k1.second - preset.k1.first) * i / (CHECK_CROPS - 1);
+        s.k2 = k2Fromk1(s.k1);
+
+        auto a = tiled.render(image, s);
+        auto b = plain.render(image, s);
+        if (!a || !b) {
+            printf("Error: Crop %d failed to render\n", i);
+            return false;
+        }
+
+        distorted.add(a->image, b->image);
+        undistorted.add(a->undistorted, b->undistorted);
+    }
+
+    ExportStats     stats;
+    tiled.report(stats);
+
+    printf("Tiled against untiled, %d paired crops, %d tile uploads, %d misses\n",
+           CHECK_CROPS, stats.tileUploads, stats.tileMisses);
+    distorted.print("distorted");
+    undistorted.print("undistorted");
+
+    return (distorted.passed() && undistorted.passed());
+}
@@ -10,35 +10,59 @@
 
 
 
-static float k2Fromk1(float k1)
+typedef QList<QSharedPointer<Exporter::EncodedImage>>      EncodedList;
+typedef QFuture<EncodedList>                                EncodeFuture;
+
+static EncodeFuture encodeAsync(
+        QSharedPointer<Exporter::DatasetSink> sink,
+        QSharedPointer<Exporter::DistortionFanOut> fanOut,
+        QSharedPointer<Exporter::RenderedImage> frame
+    )
 {
-    return 0.019*k1 + 0.805*k1*k1;
+    return QtConcurrent::run([sink, fanOut, frame]() {
+        EncodedList     result;
+
+        // One frame, or its distortion variants
+        QList<QSharedPointer<Exporter::RenderedImage>>  frames;
+        if (fanOut) {
+            frames = fanOut->expand(frame);
+        } else {
+            frames.append(frame);
+        }
+
+        for (auto &f : frames) {
+            result.append(sink->encode(f, f->sample));
+        }
+        return result;
+    });
 }
 
-static void randomSample(Exporter::CropSample &sample, Preset &preset)
+static void storeEncoded(QSharedPointer<Exporter::DatasetSink> sink, const EncodedList &encoded)
 {
-    // view
-    sample.p = uniform(preset.rangePan);
-    sample.t = uniform(preset.rangeTilt);
-    sample.r = uniform(preset.rangeRoll);
-    sample.fov = uniform(preset.rangeFOV);
-
-    // distortion
-    sample.k1 = uniform(preset.k1);
-    sample.k2 = k2Fromk1(sample.k1) + normal(0.0, preset.epsK2);
+    for (auto &e : encoded) {
+        sink->store(e);
+    }
 }
 
 
 static bool executeExport(
         Preset &preset,
         QSharedPointer<Exporter::PipelineSource<Exporter::Image>> source,
-        QSharedPointer<Exporter::CropRenderer> renderer,
-        QSharedPointer<Exporter::DatasetSink> sink
+        QSharedPointer<Exporter::Prefetcher> prefetcher,
+        QSharedPointer<Exporter::RenderBackend> renderer,
+        QSharedPointer<Exporter::DatasetSink> sink,
+        QSharedPointer<Exporter::DistortionFanOut> fanOut,
+        QSharedPointer<Exporter::CropSampler> sampler,
+        QSharedPointer<Exporter::CropFilter> filter,
+        Exporter::ExportStats &stats
     )
 {
 
     bool isComplete = false;
 
+    // Each rendered crop gives this many images
+    int perCrop = (fanOut ? fanOut->count() : 1);
+    int nCrops = (preset.nImages + perCrop - 1) / perCrop;
 
     indicators::ProgressBar bar{
         indicators::option::BarWidth{50},
@@ -46,31 +70,88 @@ static bool executeExport(
         indicators::option::ShowElapsedTime{true},
         indicators::option::ShowRemainingTime{true},
         indicators::option::ShowPercentage{true},
-        indicators::option::MaxProgress(preset.nImages)
+        indicators::option::MaxProgress(nCrops)
       };
 
     bar.set_progress(0);
 
+    // Frames being compressed on the worker threads, stored in order
+    QList<EncodeFuture>     encoding;
+    int                     maxEncoding = 2 * QThread::idealThreadCount();
+    int                     submitted = 0;
+
+    // Crops of one panorama, rendered together
+    QSharedPointer<Exporter::Image>     batchImage;
+    std::vector<Exporter::CropSample>   batch;
+    int                                 batchSize = renderer->batchSize();
+    if (batchSize <= 0) {
+        printf("Error: No renderer initialized, nothing to render\n");
+        return false;
+    }
+
+    // Hand the frames read back so far to the encoders
+    auto collect = [&]() {
+        auto frames = renderer->collect();
+        stats.rendered += frames.size();
+        for (auto &frame : frames) {
+            encoding.append(encodeAsync(sink, fanOut, frame));
+        }
+    };
+
+    auto flush = [&]() {
+        if (batch.empty()) return ;
+
+        // Blocks while every context has a batch queued
+        renderer->submit(batchImage, batch);
+        batch.clear();
+        collect();
+
+        // Overlap the upload of the next panorama
+        renderer->prefetch(prefetcher->upcoming());
+    };
+
     // Exporting process
     source->reset();
     while (!isComplete) {
-        if (source->hasCurrent()) {
+        if (source->hasCurrent() && submitted < nCrops) {
 
 
             auto inputImage = source->current();
             if (inputImage) {
 
-                // TODO: random sampling
                 Exporter::CropSample    crop;
-                randomSample(crop, preset);
-
-                auto outputImage = renderer->render(inputImage, crop);
-                sink->write(outputImage, crop);
+                sampler->sample(crop);
+
+                // Resample crops landing on unusable areas
+                if (filter) {
+                    int attempt = 0;
+                    auto verdict = filter->test(*inputImage, crop);
+                    while (verdict != Exporter::CropFilter::Accepted) {
+                        if (verdict == Exporter::CropFilter::RejectedDark) {
+                            stats.rejectedDark ++;
+                        } else {
+                            stats.rejectedNadir ++;
+                        }
+
+                        // Give up and keep the last one
+                        if (++attempt > preset.retries) {
+                            stats.forced ++;
+                            break;
+                        }
+
+                        sampler->sample(crop);
+                        verdict = filter->test(*inputImage, crop);
+                    }
+                }
 
-                // Are we done ?
-                if (sink->isComplete()) {
-                    isComplete = true;
+                // New panorama or a full batch
+                if (inputImage != batchImage || (int)batch.size() >= batchSize) {
+                    flush();
+                    batchImage = inputImage;
                 }
+
+                batch.push_back(fanOut ? fanOut->prepare(crop) : crop);
+                submitted ++;
             }
 
             // advance
@@ -80,6 +161,24 @@ static bool executeExport(
         } else {
             isComplete = true;
         }
+
+        // Store what is done, keep the number of frames in flight bounded
+        while (!encoding.isEmpty() &&
+               (encoding.first().isFinished() || encoding.size() > maxEncoding)
+               ) {
+            storeEncoded(sink, encoding.takeFirst().result());
+        }
+    }
+
+    // Drain the pipeline
+    flush();
+    renderer->finish();
+    collect();
+
+    // Only the crops read back count, batches the backend failed are lost
+    stats.failed = submitted - stats.rendered;
+    while (!encoding.isEmpty()) {
+        storeEncoded(sink, encoding.takeFirst().result());
     }
 
     return true;
@@ -122,9 +221,18 @@ bool taskExport(Args &args)
         imageList = images.second;
     }
 
-    // How many images do we need ?
+    // Distortion variants of one render, the rendered preset is widened
+    QSharedPointer<Exporter::DistortionFanOut>  fanOut;
+    Preset      renderPreset = preset;
+    if (preset.fanOut) {
+        fanOut = makeNew<Exporter::DistortionFanOut>(&preset);
+        renderPreset = fanOut->renderPreset(preset);
+    }
+
+    // How many images do we need ? Crops to render, with the fan-out
     int     nFiles = imageList.size();
-    int     totalImages = preset.nImages;
+    int     perCrop = (fanOut ? fanOut->count() : 1);
+    int     totalImages = (preset.nImages + perCrop - 1) / perCrop;
     if (nFiles <= 0) {
         printf("Error: nFiles <= 0\n");
         return false;
@@ -139,8 +247,16 @@ bool taskExport(Args &args)
     //----------------------------------------------------
     //  Build the pipeline
 
-    auto s1 = makeNew<Exporter::DatasetImageSource>(args.inputFolder.c_str(), imageList);
-    auto s2 = makeNew<Exporter::Repeater>(s1, perImage);
+    QSharedPointer<Exporter::CropFilter>    filter;
+    if (preset.rejection) {
+        filter = makeNew<Exporter::CropFilter>(&preset);
+    }
+
+    // The tiled and CPU renderers take panoramas over the texture limit
+    bool    largeImages = (renderPreset.tiling != "never" || args.renderer == "cpu");
+    auto s1 = makeNew<Exporter::DatasetImageSource>(args.inputFolder.c_str(), imageList, filter, largeImages);
+    auto pf = makeNew<Exporter::Prefetcher>(s1);
+    auto s2 = makeNew<Exporter::Repeater>(pf, perImage);
     auto s3 = makeNew<Exporter::CycleCounter>(s2, cycles);
 
 
@@ -150,22 +266,26 @@ bool taskExport(Args &args)
     //glFormat.setSamples(16);
     QSurfaceFormat::setDefaultFormat(glFormat);
 
-    auto offs = makeNew<QOffscreenSurface>();
-    offs->create();
-
-
-    auto renderer = makeNew<Exporter::CropRenderer>(offs.get(), preset.renderSize);
+    // Render contexts, the command line wins over the preset
+    int     poolSize = (args.pool > 0 ? args.pool : preset.pool);
+    auto renderer = Exporter::RenderBackend::create(args.renderer.c_str(), &renderPreset, poolSize);
 
     // TODO: params ...
     auto sink = makeNew<Exporter::DatasetSink>(outputFile.c_str(), &preset);
 
 
-    printf("Starting export : %d images\n", totalImages);
+    printf("Starting export : %d images, %d render contexts\n", preset.nImages, renderer->contexts());
 
     // Execute export !
-    executeExport(preset, s3, renderer, sink);
+    Exporter::ExportStats   stats;
+    auto sampler = Exporter::CropSampler::create(&preset);
+    if (!executeExport(preset, s3, pf, renderer, sink, fanOut, sampler, filter, stats)) {
+        return false;
+    }
 
     printf("Export complete.\n");
+    renderer->report(stats);
+    stats.print();
 
     return true;
 }
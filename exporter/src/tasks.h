@@ -13,5 +13,9 @@ bool taskExport(Args &args);
 
 bool taskSplit(Args &args);
 
+bool taskBench(Args &args);
+
+bool taskCheck(Args &args);
+
 
 #endif // TASKS_H
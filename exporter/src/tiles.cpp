@@ -0,0 +1,355 @@
+//-----------------------------------------------------------------------------
+//
+//  Football360 Exporter
+//
+//  Author : Igor Janos
+//
+//-----------------------------------------------------------------------------
+#include "pch.h"
+
+
+namespace Exporter {
+
+
+
+//-----------------------------------------------------------------------------
+//
+//  TiledPanorama
+//
+//-----------------------------------------------------------------------------
+
+TiledPanorama::TiledPanorama(QOpenGLExtraFunctions *func, int budget, int maxTextureSize,
+                             bool apaired) :
+    f(func),
+    tiles(nullptr),
+    table(nullptr),
+    overview(nullptr),
+    layers(1),
+    stamp(0),
+    tilesX(0),
+    tilesY(0),
+    overviewLimit(qMin((int)OVERVIEW_SIZE, maxTextureSize)),
+    paired(apaired),
+    uploads(0),
+    misses(0)
+{
+    // Number of layers fitting the budget
+    qint64  layerBytes = (qint64)LAYER_SIZE * LAYER_SIZE * 4;
+    GLint   maxLayers = 0;
+    f->glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+
+    layers = (int)(((qint64)budget * 1024 * 1024) / layerBytes);
+    layers = qBound(1, layers, qMax(1, (int)maxLayers));
+
+    tiles = new QOpenGLTexture(QOpenGLTexture::Target2DArray);
+    tiles->setSize(LAYER_SIZE, LAYER_SIZE);
+    tiles->setLayers(layers);
+    tiles->setFormat(QOpenGLTexture::RGBA8_UNorm);
+    tiles->setMipLevels(1);
+    tiles->allocateStorage(QOpenGLTexture::BGRA, QOpenGLTexture::UInt8);
+    tiles->setMinMagFilters(QOpenGLTexture::Linear, QOpenGLTexture::Linear);
+    tiles->setWrapMode(QOpenGLTexture::ClampToEdge);
+
+    staging.resize((size_t)layerBytes);
+
+    qDebug() << "Tile cache :" << layers << "layers";
+}
+
+TiledPanorama::~TiledPanorama()
+{
+    if (tiles) delete tiles;
+    if (table) delete table;
+    if (overview) delete overview;
+
+    tiles = table = overview = nullptr;
+}
+
+void TiledPanorama::setImage(QSharedPointer<Image> aimage)
+{
+    if (image == aimage) return ;
+    image = aimage;
+
+    // JPEGs decode to RGB32, which is BGRA in memory
+    source = image->image;
+    if (source.format() != QImage::Format_RGB32 && source.format() != QImage::Format_ARGB32) {
+        source = source.convertToFormat(QImage::Format_RGB32);
+    }
+
+    int w = source.width();
+    int h = source.height();
+    int tx = (w + TILE_CONTENT - 1) / TILE_CONTENT;
+    int ty = (h + TILE_CONTENT - 1) / TILE_CONTENT;
+
+    // Indirection table
+    if (!table || tx != tilesX || ty != tilesY) {
+        if (table) delete table;
+
+        table = new QOpenGLTexture(QOpenGLTexture::Target2D);
+        table->setSize(tx, ty);
+        table->setFormat(QOpenGLTexture::R32F);
+        table->setMipLevels(1);
+        table->allocateStorage(QOpenGLTexture::Red, QOpenGLTexture::Float32);
+        table->setMinMagFilters(QOpenGLTexture::Nearest, QOpenGLTexture::Nearest);
+        table->setWrapMode(QOpenGLTexture::ClampToEdge);
+    }
+    tilesX = tx;
+    tilesY = ty;
+
+    // Nothing resident
+    tileLayer.assign(tilesX * tilesY, -1);
+    layerTile.assign(layers, -1);
+    layerStamp.assign(layers, 0);
+    updateTable();
+
+    buildOverview();
+}
+
+void TiledPanorama::buildOverview()
+{
+    int     w = source.width();
+    int     h = source.height();
+    double  scale = qMin(1.0, (double)overviewLimit / (double)qMax(w, h));
+    int     ow = qMax(1, (int)round(w * scale));
+    int     oh = qMax(1, (int)round(h * scale));
+
+    cv::Mat     src(h, w, CV_8UC4, (void*)source.constBits(), source.bytesPerLine());
+    cv::Mat     dst;
+    cv::resize(src, dst, cv::Size(ow, oh), 0, 0, cv::INTER_AREA);
+
+    if (!overview || overview->width() != ow || overview->height() != oh) {
+        if (overview) delete overview;
+
+        overview = new QOpenGLTexture(QOpenGLTexture::Target2D);
+        overview->setSize(ow, oh);
+        overview->setFormat(QOpenGLTexture::RGBA8_UNorm);
+        overview->setMipLevels(1);
+        overview->allocateStorage(QOpenGLTexture::BGRA, QOpenGLTexture::UInt8);
+        overview->setMinMagFilters(QOpenGLTexture::Linear, QOpenGLTexture::Linear);
+        overview->setWrapMode(QOpenGLTexture::DirectionS, QOpenGLTexture::Repeat);
+        overview->setWrapMode(QOpenGLTexture::DirectionT, QOpenGLTexture::Repeat);
+    }
+
+    overview->setData(QOpenGLTexture::BGRA, QOpenGLTexture::UInt8, dst.data);
+}
+
+void TiledPanorama::markRange(double u0, double u1, double v0, double v1, std::vector<bool> &needed)
+{
+    int     w = source.width();
+    int     h = source.height();
+
+    // One texel around for the bilinear taps
+    double  x0 = u0 * w - 1.0;
+    double  x1 = u1 * w + 1.0;
+    double  y0 = qBound(0.0, v0 * h - 1.0, (double)(h-1));
+    double  y1 = qBound(0.0, v1 * h + 1.0, (double)(h-1));
+
+    int     tx0 = (int)floor(x0 / TILE_CONTENT);
+    int     tx1 = (int)floor(x1 / TILE_CONTENT);
+    int     ty0 = (int)floor(y0 / TILE_CONTENT);
+    int     ty1 = (int)floor(y1 / TILE_CONTENT);
+
+    // Whole longitude range
+    if (tx1 - tx0 + 1 >= tilesX) {
+        tx0 = 0;
+        tx1 = tilesX - 1;
+    }
+
+    for (int ty=ty0; ty<=ty1; ty++) {
+        for (int tx=tx0; tx<=tx1; tx++) {
+            int x = ((tx % tilesX) + tilesX) % tilesX;
+            needed[ty * tilesX + x] = true;
+        }
+    }
+}
+
+void TiledPanorama::markFootprint(const CropSample &s, QVector2D canvas, float k1, float k2,
+                                  std::vector<bool> &needed)
+{
+    const int   n = FOOTPRINT_GRID;
+    cv::Mat     rk = viewRK(s, canvas);
+
+    std::vector<QPointF>    uv((n+1) * (n+1));
+    for (int y=0; y<=n; y++) {
+        for (int x=0; x<=n; x++) {
+            QPointF t((double)x / n, (double)y / n);
+            uv[y*(n+1) + x] = projectPixel(rk, canvas, k1, k2, t);
+        }
+    }
+
+    // Bounding range of every grid cell
+    for (int y=0; y<n; y++) {
+        for (int x=0; x<n; x++) {
+            QPointF c[4] = {
+                uv[y*(n+1) + x],     uv[y*(n+1) + x+1],
+                uv[(y+1)*(n+1) + x], uv[(y+1)*(n+1) + x+1]
+            };
+
+            double  us[4];
+            double  v0 = 1.0, v1 = 0.0;
+            for (int i=0; i<4; i++) {
+                us[i] = c[i].x();
+                v0 = qMin(v0, c[i].y());
+                v1 = qMax(v1, c[i].y());
+            }
+            std::sort(us, us+4);
+
+            // Covered arc is the complement of the largest gap,
+            // this handles cells crossing the seam
+            int     g = 3;
+            double  gap = us[0] + 1.0 - us[3];
+            for (int i=0; i<3; i++) {
+                if (us[i+1] - us[i] > gap) {
+                    gap = us[i+1] - us[i];
+                    g = i;
+                }
+            }
+
+            double  u0 = us[(g+1) % 4];
+            double  u1 = u0 + (1.0 - gap);
+
+            // Spans half of the longitudes - the cell covers a pole
+            if (u1 - u0 > 0.5) {
+                u0 = 0.0;
+                u1 = 1.0;
+                if (v0 < 0.5) v0 = 0.0; else v1 = 1.0;
+            }
+
+            // Grow by a quarter of the cell for the curvature inside
+            double  du = 0.25 * (u1 - u0);
+            double  dv = 0.25 * (v1 - v0);
+            markRange(u0 - du, u1 + du, v0 - dv, v1 + dv, needed);
+        }
+    }
+}
+
+void TiledPanorama::uploadTile(int tile, int layer)
+{
+    int     w = source.width();
+    int     h = source.height();
+    int     tx = tile % tilesX;
+    int     ty = tile / tilesX;
+    int     sx0 = tx * TILE_CONTENT - GUTTER;
+    int     sy0 = ty * TILE_CONTENT - GUTTER;
+
+    // Copy the tile with its gutter - wrapped horizontally, clamped vertically
+    for (int r=0; r<LAYER_SIZE; r++) {
+        int             sy = qBound(0, sy0 + r, h-1);
+        const uchar     *line = source.constScanLine(sy);
+        uchar           *dst = staging.data() + (size_t)r * LAYER_SIZE * 4;
+
+        int x = 0;
+        while (x < LAYER_SIZE) {
+            int sx = (((sx0 + x) % w) + w) % w;
+            int count = qMin(LAYER_SIZE - x, w - sx);
+            memcpy(dst + x*4, line + sx*4, count*4);
+            x += count;
+        }
+    }
+
+    tiles->bind();
+    f->glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    f->glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    f->glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer,
+                       LAYER_SIZE, LAYER_SIZE, 1,
+                       GL_BGRA, GL_UNSIGNED_BYTE, staging.data()
+                       );
+    tiles->release();
+}
+
+void TiledPanorama::updateTable()
+{
+    std::vector<float>  t(tileLayer.size());
+    for (size_t i=0; i<tileLayer.size(); i++) {
+        t[i] = tileLayer[i];
+    }
+
+    table->setData(QOpenGLTexture::Red, QOpenGLTexture::Float32, t.data());
+}
+
+void TiledPanorama::update(const std::vector<CropSample> &samples, QVector2D canvas)
+{
+    if (!image) return ;
+    stamp ++;
+
+    std::vector<bool>   needed(tilesX * tilesY, false);
+    for (size_t i=0; i<samples.size(); i++) {
+        markFootprint(samples[i], canvas, samples[i].k1, samples[i].k2, needed);
+
+        // The undistorted twin samples the pinhole footprint, wider than
+        // the distorted one for k1 > 0
+        if (paired && (samples[i].k1 != 0 || samples[i].k2 != 0)) {
+            markFootprint(samples[i], canvas, 0, 0, needed);
+        }
+    }
+
+    // Keep the resident ones
+    for (size_t i=0; i<needed.size(); i++) {
+        if (needed[i] && tileLayer[i] >= 0) {
+            layerStamp[tileLayer[i]] = stamp;
+        }
+    }
+
+    // Load the missing ones into free or least recently used layers
+    bool changed = false;
+    for (int i=0; i<(int)needed.size(); i++) {
+        if (!needed[i] || tileLayer[i] >= 0) continue;
+
+        int layer = -1;
+        for (int l=0; l<layers; l++) {
+            if (layerStamp[l] >= stamp) continue;
+            if (layer < 0 || layerStamp[l] < layerStamp[layer]) {
+                layer = l;
+            }
+        }
+
+        // Over budget - the overview covers it
+        if (layer < 0) {
+            misses ++;
+            continue;
+        }
+
+        if (layerTile[layer] >= 0) {
+            tileLayer[layerTile[layer]] = -1;
+        }
+        layerTile[layer] = i;
+        layerStamp[layer] = stamp;
+        tileLayer[i] = layer;
+
+        uploadTile(i, layer);
+        uploads ++;
+        changed = true;
+    }
+
+    if (changed) {
+        updateTable();
+    }
+}
+
+void TiledPanorama::bind(int unitOverview, int unitTiles, int unitTable)
+{
+    if (overview) overview->bind(unitOverview);
+    if (tiles) tiles->bind(unitTiles);
+    if (table) table->bind(unitTable);
+}
+
+QVector4D TiledPanorama::grid()
+{
+    return QVector4D(source.width(), source.height(), TILE_CONTENT, LAYER_SIZE);
+}
+
+QVector2D TiledPanorama::tileCount()
+{
+    return QVector2D(tilesX, tilesY);
+}
+
+bool TiledPanorama::needed(const QString &tiling, int maxTextureSize, QSize size)
+{
+    if (tiling == "never") return false;
+    if (tiling == "always") return true;
+
+    return (size.width() > maxTextureSize || size.height() > maxTextureSize);
+}
+
+
+
+}
@@ -0,0 +1,95 @@
+//-----------------------------------------------------------------------------
+//
+//  Football360 Exporter
+//
+//  Author : Igor Janos
+//
+//-----------------------------------------------------------------------------
+#ifndef TILES_H
+#define TILES_H
+
+
+namespace Exporter {
+
+//-----------------------------------------------------------------------------
+//
+//  Tiled panorama
+//
+//  Panoramas larger than GL_MAX_TEXTURE_SIZE are split into tiles stored
+//  in the layers of a texture array. An indirection table maps each tile
+//  of the panorama to its layer, or to -1 when it is not resident. Only
+//  the tiles under the footprint of the crops being rendered are
+//  uploaded, least recently used layers are evicted. Tiles that do not
+//  fit the budget fall back to a low resolution overview texture.
+//
+//-----------------------------------------------------------------------------
+
+class TiledPanorama
+{
+public:
+
+    // Each layer holds TILE_CONTENT texels of the panorama plus a gutter
+    // of wrapped / clamped neighbours for bilinear filtering
+    enum { LAYER_SIZE = 1024, GUTTER = 1, TILE_CONTENT = LAYER_SIZE - 2*GUTTER };
+    enum { OVERVIEW_SIZE = 4096, FOOTPRINT_GRID = 32 };
+
+protected:
+
+    QOpenGLExtraFunctions   *f;
+
+    QOpenGLTexture          *tiles;         // Target2DArray
+    QOpenGLTexture          *table;         // layer per tile
+    QOpenGLTexture          *overview;
+
+    int                     layers;
+    std::vector<int>        layerTile;
+    std::vector<uint64_t>   layerStamp;
+    std::vector<int>        tileLayer;
+    uint64_t                stamp;
+
+    QSharedPointer<Image>   image;
+    QImage                  source;         // BGRA
+    int                     tilesX, tilesY;
+    int                     overviewLimit;
+    bool                    paired;         // pinhole twins read the tiles too
+    std::vector<uchar>      staging;
+
+    void buildOverview();
+    void markFootprint(const CropSample &s, QVector2D canvas, float k1, float k2,
+                       std::vector<bool> &needed);
+    void markRange(double u0, double u1, double v0, double v1, std::vector<bool> &needed);
+    void uploadTile(int tile, int layer);
+    void updateTable();
+
+public:
+
+    int                     uploads;
+    int                     misses;
+
+public:
+    // Context has to be current, budget in megabytes
+    TiledPanorama(QOpenGLExtraFunctions *func, int budget, int maxTextureSize,
+                  bool apaired = false);
+    virtual ~TiledPanorama();
+
+    // New panorama, drops all resident tiles
+    void setImage(QSharedPointer<Image> aimage);
+
+    // Make the tiles under the crops resident
+    void update(const std::vector<CropSample> &samples, QVector2D canvas);
+
+    // Overview goes to the unit of the regular panorama texture
+    void bind(int unitOverview, int unitTiles, int unitTable);
+
+    // Panorama size in texels, tile content, layer size
+    QVector4D grid();
+    QVector2D tileCount();
+
+    // Oversized panoramas, or every one with tiling "always"
+    static bool needed(const QString &tiling, int maxTextureSize, QSize size);
+};
+
+
+}
+
+#endif // TILES_H
@@ -0,0 +1,417 @@
+//-----------------------------------------------------------------------------
+//
+//  Football360 Exporter
+//
+//  Author : Igor Janos
+//
+//-----------------------------------------------------------------------------
+#include "pch.h"
+
+
+namespace Exporter {
+
+
+
+//-----------------------------------------------------------------------------
+//
+//  PanoramaTexture
+//
+//-----------------------------------------------------------------------------
+
+PanoramaTexture::PanoramaTexture() :
+    texture(nullptr),
+    ready(0),
+    users(0),
+    pending(false),
+    timer(nullptr),
+    timed(false)
+{
+}
+
+
+//-----------------------------------------------------------------------------
+//
+//  PanoramaUploader
+//
+//-----------------------------------------------------------------------------
+
+PanoramaUploader::PanoramaUploader(QOpenGLContext *shareContext, bool amipmaps,
+                                   bool acubemap, int acubeSize) :
+    context(nullptr),
+    surface(nullptr),
+    current(-1),
+    stopping(false),
+    waiting(0),
+    mipmaps(amipmaps),
+    cubemap(acubemap),
+    cubeSize(acubeSize),
+    maxCubeSize(0),
+    cubeClamped(false)
+{
+    pbo[0] = pbo[1] = 0;
+
+    // Surface has to be created on the GUI thread
+    surface = new QOffscreenSurface();
+    surface->setFormat(shareContext->format());
+    surface->create();
+
+    context = new QOpenGLContext();
+    context->setFormat(shareContext->format());
+    context->setShareContext(shareContext);
+    context->create();
+    context->moveToThread(this);
+}
+
+PanoramaUploader::~PanoramaUploader()
+{
+    {
+        QMutexLocker    l(&lock);
+        stopping = true;
+        cond.wakeAll();
+    }
+    wait();
+
+    if (context) {
+        delete context;
+        context = nullptr;
+    }
+
+    if (surface) {
+        delete surface;
+        surface = nullptr;
+    }
+}
+
+int PanoramaUploader::findSlot(QSharedPointer<Image> image)
+{
+    for (int i=0; i<SLOTS; i++) {
+        if (textures[i].image == image) return i;
+    }
+    return -1;
+}
+
+void PanoramaUploader::prefetch(QSharedPointer<Image> image)
+{
+    if (!image) return ;
+
+    QMutexLocker    l(&lock);
+
+    // Already there, or the renderer waits for another one
+    if (waiting || request == image || findSlot(image) >= 0) return ;
+
+    request = image;
+    cond.wakeAll();
+}
+
+PanoramaTexture *PanoramaUploader::acquire(QSharedPointer<Image> image)
+{
+    int slot = -1;
+
+    {
+        QMutexLocker    l(&lock);
+
+        waiting ++;
+        while ((slot = findSlot(image)) < 0 || textures[slot].pending) {
+            if (slot < 0 && request != image) {
+                request = image;
+                cond.wakeAll();
+            }
+            cond.wait(&lock);
+        }
+        waiting --;
+
+        // From now on the other slot is free for uploads
+        current = slot;
+        textures[slot].users ++;
+    }
+
+    // GPU side wait, the CPU keeps going
+    auto f = QOpenGLContext::currentContext()->extraFunctions();
+    f->glWaitSync(textures[slot].ready, 0, GL_TIMEOUT_IGNORED);
+
+    return &textures[slot];
+}
+
+void PanoramaUploader::release(PanoramaTexture *tex)
+{
+    auto f = QOpenGLContext::currentContext()->extraFunctions();
+
+    GLsync fence = f->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    f->glFlush();
+
+    QMutexLocker    l(&lock);
+    tex->released.push_back(fence);
+    tex->users --;
+    cond.wakeAll();
+}
+
+void PanoramaUploader::report(ExportStats &stats)
+{
+    QMutexLocker    l(&lock);
+    stats.gpuUpload.merge(timeUpload);
+}
+
+void PanoramaUploader::collectTiming(PanoramaTexture &slot, bool wait)
+{
+    if (!slot.timer || !slot.timed) return ;
+    if (!wait && !slot.timer->isResultAvailable()) return ;
+
+    GLuint64 ns = slot.timer->waitForResult();
+    slot.timed = false;
+
+    QMutexLocker    l(&lock);
+    timeUpload.add(ns);
+}
+
+void PanoramaUploader::run()
+{
+    context->makeCurrent(surface);
+
+    auto f = context->extraFunctions();
+    f->glGenBuffers(2, pbo);
+    f->glGetIntegerv(GL_MAX_CUBE_MAP_TEXTURE_SIZE, &maxCubeSize);
+
+    // Upload timer per slot, where the driver has timer queries
+    for (int i=0; i<SLOTS; i++) {
+        textures[i].timer = new QOpenGLTimerQuery();
+        if (!textures[i].timer->create()) {
+            warnNoGpuTiming();
+            delete textures[i].timer;
+            textures[i].timer = nullptr;
+        }
+    }
+
+    while (true) {
+        QSharedPointer<Image>   image;
+        int                     slot;
+
+        {
+            QMutexLocker    l(&lock);
+            while (!stopping && !request) {
+                cond.wait(&lock);
+            }
+            if (stopping) break;
+
+            // Never touch the texture being rendered from, and wait
+            // for the renderers still sampling the other one
+            slot = (current == 0 ? 1 : 0);
+            while (!stopping && textures[slot].users > 0) {
+                cond.wait(&lock);
+                slot = (current == 0 ? 1 : 0);
+            }
+            if (stopping) break;
+
+            image = request;
+            request = nullptr;
+            if (findSlot(image) >= 0) continue;
+
+            textures[slot].image = image;
+            textures[slot].pending = true;
+        }
+
+        upload(textures[slot], image);
+
+        {
+            QMutexLocker    l(&lock);
+            textures[slot].pending = false;
+            cond.wakeAll();
+        }
+    }
+
+    cleanup();
+
+    context->doneCurrent();
+    context->moveToThread(surface->thread());
+}
+
+void PanoramaUploader::upload(PanoramaTexture &slot, QSharedPointer<Image> image)
+{
+    auto f = context->extraFunctions();
+
+    std::vector<GLsync>     released;
+    {
+        QMutexLocker    l(&lock);
+        released.swap(slot.released);
+    }
+
+    // Previous draws from this texture must complete first
+    for (size_t i=0; i<released.size(); i++) {
+        f->glWaitSync(released[i], 0, GL_TIMEOUT_IGNORED);
+        f->glDeleteSync(released[i]);
+    }
+    if (slot.ready) {
+        f->glDeleteSync(slot.ready);
+        slot.ready = 0;
+    }
+
+    // Time of the previous upload, dropped if the GPU is not done yet
+    collectTiming(slot, false);
+    slot.timed = false;
+
+    // JPEGs decode to RGB32, which is BGRA in memory
+    QImage  src = image->image;
+    if (src.format() != QImage::Format_RGB32 && src.format() != QImage::Format_ARGB32) {
+        src = src.convertToFormat(QImage::Format_RGB32);
+    }
+
+    // The faces are resampled here, off the render threads
+    if (cubemap) {
+        buildCube(src);
+        allocate(slot, QOpenGLTexture::TargetCubeMap, cube.size, cube.size);
+    } else {
+        allocate(slot, QOpenGLTexture::Target2D, src.width(), src.height());
+    }
+
+    if (slot.timer) {
+        slot.timer->begin();
+    }
+
+    slot.texture->bind();
+    if (cubemap) {
+        for (int face=0; face<KernelPanorama::CUBE_FACES; face++) {
+            streamRows(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face,
+                       (const uchar*)cube.row(face, 0), cube.stride() * 4,
+                       cube.size, cube.size
+                       );
+        }
+    } else {
+        streamRows(GL_TEXTURE_2D, src.constBits(), src.bytesPerLine(), src.width(), src.height());
+    }
+
+    // Footprint sampling reads the whole mip chain
+    if (mipmaps) {
+        f->glGenerateMipmap(cubemap ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D);
+    }
+    slot.texture->release();
+
+    if (slot.timer) {
+        slot.timer->end();
+        slot.timed = true;
+    }
+
+    // Signal readiness to the render context
+    slot.ready = f->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    f->glFlush();
+}
+
+void PanoramaUploader::allocate(PanoramaTexture &slot, QOpenGLTexture::Target target, int w, int h)
+{
+    // Immutable storage, reallocated only when the size changes
+    if (slot.texture && slot.texture->target() == target &&
+        slot.texture->width() == w && slot.texture->height() == h) {
+        return ;
+    }
+
+    if (slot.texture) {
+        delete slot.texture;
+    }
+
+    slot.texture = new QOpenGLTexture(target);
+    slot.texture->setSize(w, h);
+    slot.texture->setFormat(QOpenGLTexture::RGBA8_UNorm);
+    slot.texture->setMipLevels(mipmaps ? slot.texture->maximumMipLevels() : 1);
+    slot.texture->allocateStorage(QOpenGLTexture::BGRA, QOpenGLTexture::UInt8);
+    if (mipmaps) {
+        slot.texture->setMinMagFilters(QOpenGLTexture::LinearMipMapLinear, QOpenGLTexture::Linear);
+        slot.texture->setMaximumAnisotropy(16.0);
+    } else {
+        slot.texture->setMinMagFilters(QOpenGLTexture::Linear, QOpenGLTexture::Linear);
+    }
+
+    // Seamless cube filtering ignores the wrap mode
+    QOpenGLTexture::WrapMode    wrap = (target == QOpenGLTexture::TargetCubeMap ?
+                                        QOpenGLTexture::ClampToEdge : QOpenGLTexture::Repeat);
+    slot.texture->setWrapMode(QOpenGLTexture::DirectionS, wrap);
+    slot.texture->setWrapMode(QOpenGLTexture::DirectionT, wrap);
+}
+
+void PanoramaUploader::streamRows(GLenum target, const uchar *first, int rowBytes, int w, int h)
+{
+    auto f = context->extraFunctions();
+
+    // Stream in strips, alternating the two PBOs
+    int stripRows = qMax(1, (int)STRIP_BYTES / rowBytes);
+
+    f->glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    f->glPixelStorei(GL_UNPACK_ROW_LENGTH, rowBytes / 4);
+
+    int k = 0;
+    for (int y=0; y<h; y += stripRows) {
+        int         rows = qMin(stripRows, h - y);
+        GLsizeiptr  bytes = (GLsizeiptr)rows * rowBytes;
+
+        f->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[k]);
+        f->glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+
+        void *dst = f->glMapBufferRange(
+                        GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+                        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT
+                    );
+        if (dst) {
+            memcpy(dst, first + (size_t)y * rowBytes, bytes);
+            f->glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+            f->glTexSubImage2D(target, 0, 0, y, w, rows,
+                               GL_BGRA, GL_UNSIGNED_BYTE, nullptr
+                               );
+        }
+
+        k ^= 1;
+    }
+
+    f->glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    f->glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+void PanoramaUploader::buildCube(const QImage &src)
+{
+    KernelPanorama  equirect;
+    equirect.pixels = (const uint32_t*)src.constBits();
+    equirect.width = src.width();
+    equirect.height = src.height();
+    equirect.stride = src.bytesPerLine() / 4;
+    equirect.layout = KernelPanorama::LAYOUT_LINEAR;
+
+    int n = (cubeSize > 0 ? cubeSize : CubeMap::autoSize(src.width()));
+    if (maxCubeSize > 0 && n > maxCubeSize) {
+        if (!cubeClamped) {
+            printf("Warning: Cube face %d over GL_MAX_CUBE_MAP_TEXTURE_SIZE, using %d\n", n, maxCubeSize);
+            cubeClamped = true;
+        }
+        n = maxCubeSize;
+    }
+
+    cube.build(equirect, n);
+}
+
+void PanoramaUploader::cleanup()
+{
+    auto f = context->extraFunctions();
+
+    for (int i=0; i<SLOTS; i++) {
+        PanoramaTexture &slot = textures[i];
+
+        // The last uploads are done by now
+        collectTiming(slot, true);
+        if (slot.timer) delete slot.timer;
+        slot.timer = nullptr;
+
+        if (slot.ready) f->glDeleteSync(slot.ready);
+        for (size_t j=0; j<slot.released.size(); j++) {
+            f->glDeleteSync(slot.released[j]);
+        }
+        if (slot.texture) delete slot.texture;
+
+        slot.ready = 0;
+        slot.released.clear();
+        slot.texture = nullptr;
+        slot.image = nullptr;
+    }
+
+    f->glDeleteBuffers(2, pbo);
+    pbo[0] = pbo[1] = 0;
+}
+
+
+
+}
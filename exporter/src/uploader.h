@@ -0,0 +1,106 @@
+//-----------------------------------------------------------------------------
+//
+//  Football360 Exporter
+//
+//  Author : Igor Janos
+//
+//-----------------------------------------------------------------------------
+#ifndef UPLOADER_H
+#define UPLOADER_H
+
+
+namespace Exporter {
+
+//-----------------------------------------------------------------------------
+//
+//  Asynchronous panorama upload
+//
+//  Two immutable-storage panorama textures. While the renderers sample
+//  one of them, the upload thread streams the next panorama into the
+//  other one through pixel buffer objects on a shared GL context.
+//  Fences order the upload against the draws on both sides. Several
+//  render contexts of one share group may use the same uploader.
+//  Cube map presets resample the panorama into the six faces on the
+//  upload thread and stream those instead.
+//
+//-----------------------------------------------------------------------------
+
+class PanoramaTexture
+{
+public:
+
+    QOpenGLTexture          *texture;
+    QSharedPointer<Image>   image;
+    GLsync                  ready;          // upload finished
+    std::vector<GLsync>     released;       // last draws sampling it
+    int                     users;          // renderers between acquire & release
+    bool                    pending;
+    QOpenGLTimerQuery       *timer;         // last upload into this slot
+    bool                    timed;
+
+public:
+    PanoramaTexture();
+};
+
+
+class PanoramaUploader : public QThread
+{
+protected:
+
+    enum { SLOTS = 2, STRIP_BYTES = 32*1024*1024 };
+
+    QOpenGLContext          *context;
+    QOffscreenSurface       *surface;
+
+    QMutex                  lock;
+    QWaitCondition          cond;
+    PanoramaTexture         textures[SLOTS];
+    QSharedPointer<Image>   request;
+    int                     current;
+    bool                    stopping;
+    int                     waiting;
+    bool                    mipmaps;
+    bool                    cubemap;
+    int                     cubeSize;
+    int                     maxCubeSize;
+    bool                    cubeClamped;
+    CubeMap                 cube;
+
+    GLuint                  pbo[2];
+    TimingHistogram         timeUpload;
+
+    int findSlot(QSharedPointer<Image> image);
+    void collectTiming(PanoramaTexture &slot, bool wait);
+    void upload(PanoramaTexture &slot, QSharedPointer<Image> image);
+    void allocate(PanoramaTexture &slot, QOpenGLTexture::Target target, int w, int h);
+    void streamRows(GLenum target, const uchar *first, int rowBytes, int w, int h);
+    void buildCube(const QImage &src);
+    void cleanup();
+
+    // QThread
+    virtual void run();
+
+public:
+    // Must be constructed on the GUI thread
+    PanoramaUploader(QOpenGLContext *shareContext, bool amipmaps = false,
+                     bool acubemap = false, int acubeSize = 0);
+    virtual ~PanoramaUploader();
+
+    // Queue the upload of the next panorama
+    void prefetch(QSharedPointer<Image> image);
+
+    // Called on the render thread with its context current.
+    // Waits until the image is uploaded and makes it the current one.
+    // The texture is not replaced until the matching release().
+    PanoramaTexture *acquire(QSharedPointer<Image> image);
+
+    // Fences the draws issued so far against the texture
+    void release(PanoramaTexture *tex);
+
+    void report(ExportStats &stats);
+};
+
+
+}
+
+#endif // UPLOADER_H
@@ -31,14 +31,21 @@ FOOTBALL360_SET_NAMES = {
 #------------------------------------------------------------------------------
 
 class FootballDataset(Dataset):
-    def __init__(self, folder, setName, scaleShape=None, asTensor=True):
+    def __init__(self, folder, setName, scaleShape=None, asTensor=True, groupShape=None):
         self.folder = folder
         self.h5file = None
         self.filename = os.path.join(folder, FOOTBALL360_SET_NAMES[setName])
         self.url = BASE_DOWNLOAD_URL + FOOTBALL360_SET_NAMES[setName]
         self.info = {}
         self.labels = None
+        self.augment = None
+        self.undistorted = None
         self.scaleShape = scaleShape
+        self.resizeShape = scaleShape
+        # Pre-scaled group read when present, never resized
+        self.groupShape = groupShape
+        self.imagesName = "images"
+        self.undistortedName = "undistorted"
         self.len = 0
         self.asTensor = asTensor
         self.assertOpen()
@@ -71,23 +78,56 @@ class FootballDataset(Dataset):
                     return None
 
             self.h5file = h5py.File(self.filename, mode="r")
-            groupImages = self.h5file["images"]
+
+            # Exported at this size already - no resize on every read
+            shape = self.scaleShape if (self.scaleShape is not None) else self.groupShape
+            if (shape is not None):
+                suffix = "_{}x{}".format(shape[0], shape[1])
+                if (("images" + suffix) in self.h5file):
+                    self.imagesName = "images" + suffix
+                    self.undistortedName = "undistorted" + suffix
+                    self.resizeShape = None
+
+            groupImages = self.h5file[self.imagesName]
             self.len = len(groupImages)
             self.info = json.loads(bytes(self.h5file.get("info")))
             self.labels = self.h5file.get("labels")
+            # Optional - present when the preset applied augmentation
+            self.augment = self.h5file.get("augment")
+            # Optional - undistorted twins of the paired presets
+            self.undistorted = self.h5file.get(self.undistortedName)
 
 
     def loadRaw(self, idx):
-        groupImages = self.h5file["images"]
+        groupImages = self.h5file[self.imagesName]
         # Loadneme image
-        bImage = groupImages.get(str(idx))
+        image = self.decode(groupImages.get(str(idx)))
+        dist = np.array(self.h5file["labels"][idx])
+        return image, dist
+
+    def decode(self, bImage):
         image = cv2.imdecode(np.array(bImage), cv2.IMREAD_COLOR)
         image = cv2.cvtColor(image, cv2.COLOR_BGR2RGB)
-        if (self.scaleShape is not None):
-            image = cv2.resize(image, self.scaleShape, interpolation=cv2.INTER_AREA)
+        if (self.resizeShape is not None):
+            image = cv2.resize(image, self.resizeShape, interpolation=cv2.INTER_AREA)
+        return image
 
-        dist = np.array(self.h5file["labels"][idx])
-        return image, dist
+    def getUndistorted(self, idx):
+        # Same view as image idx, rendered with k1 = k2 = 0
+        self.assertOpen()
+        if (self.undistorted is None):
+            return None
+        image = self.decode(self.undistorted.get(str(idx)))
+        if (self.asTensor):
+            image = FootballDataset.toTensor(image)
+        return image
+
+    def getAugment(self, idx):
+        # hue, saturation, value, gamma, noise, vignetting, seed
+        self.assertOpen()
+        if (self.augment is None):
+            return None
+        return np.array(self.augment[idx])
 
     @staticmethod
     def toNumpyImage(tx: torch.Tensor):
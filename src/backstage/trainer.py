@@ -24,7 +24,9 @@ from torchvision import transforms
 
 class DataSource:
     def __init__(self, conf, subset, batchSize):
-        self.ds = FootballDataset(conf["folder"], conf[subset], asTensor=True)
+        # Reads the 224x224 images when the set was exported with them,
+        # older sets load as before and the transform resizes them
+        self.ds = FootballDataset(conf["folder"], conf[subset], asTensor=True, groupShape=(224, 224))
         self.transform = transforms.Compose([
             transforms.Resize((224, 224)),
             transforms.Normalize(mean=[0.485, 0.456, 0.406], std=[0.229, 0.224, 0.225])